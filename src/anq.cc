@@ -0,0 +1,86 @@
+/**************************************************************** anq.cc
+ * a single executable for all algebras and coefficient rings.
+ *
+ * the copies of nq listed in ANQ_VARIANTS (see the Makefile) are
+ * linked together, each compiled in its own namespace nq_x_P_K with
+ * all its compile-time specializations; the command line chooses one
+ * and runs it as if it were nq_x_P_K.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#ifndef ANQ_VARIANTS
+#define ANQ_VARIANTS VARIANT(l,0,1) VARIANT(g,0,1) VARIANT(a,0,1)
+#endif
+
+#define VARIANT(a,p,k) namespace nq_##a##_##p##_##k { int main(int, char **); }
+ANQ_VARIANTS
+#undef VARIANT
+
+static const struct variant {
+  char algebra;
+  unsigned p, k;
+  int (*main)(int, char **);
+} variants[] = {
+#define VARIANT(a,p,k) { #a[0], p, k, nq_##a##_##p##_##k::main },
+  ANQ_VARIANTS
+#undef VARIANT
+};
+
+static const char USAGE[] = "Usage: anq [-l | -g | -a] [-r <P>_<K>] <nq options> [<inputfile>] [<maximal weight>]\n"
+  "\t[-l | -g | -a]\tcompute a Lie algebra (default), group or associative algebra\n"
+  "\t[-r <P>_<K>]\tcoefficients, as for nq_x_P_K: Z/P^K if P>0, otherwise integers of K limbs (0 = arbitrary precision); default 0_1\n"
+  "\t(these must be given as separate arguments, before any '--')";
+
+static void printvariants(FILE *f) {
+  fprintf(f, "Available:");
+  for (const variant &v : variants)
+    fprintf(f, " -%c -r %u_%u", v.algebra, v.p, v.k);
+  fprintf(f, "\n");
+}
+
+int main(int argc, char **argv) {
+  char algebra = 'l';
+  unsigned p = 0, k = 1;
+  bool help = false;
+  std::vector<char *> args = { argv[0] };
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--")) {
+      while (i < argc)
+	args.push_back(argv[i++]);
+      break;
+    }
+    if (!strcmp(argv[i], "-l") || !strcmp(argv[i], "-g") || !strcmp(argv[i], "-a"))
+      algebra = argv[i][1];
+    else if (!strncmp(argv[i], "-r", 2)) {
+      const char *ring = argv[i][2] ? argv[i]+2 : (i+1 < argc ? argv[++i] : "");
+      if (sscanf(ring, "%u_%u", &p, &k) != 2) {
+	fprintf(stderr, "Coefficient ring '%s' should be given as P_K\n%s\n", ring, USAGE);
+	return 1;
+      }
+    } else {
+      if (!strcmp(argv[i], "-h"))
+	help = true;
+      args.push_back(argv[i]);
+    }
+  }
+  args.push_back(nullptr);
+
+  if (help) {
+    printf("%s\n", USAGE);
+    printvariants(stdout);
+    printf("\n");
+  }
+
+  for (const variant &v : variants)
+    if (v.algebra == algebra && v.p == p && v.k == k)
+      return v.main(args.size()-1, args.data());
+
+  fprintf(stderr, "This executable does not contain -%c -r %u_%u\n", algebra, p, k);
+  printvariants(stderr);
+  return 1;
+}
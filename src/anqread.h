@@ -0,0 +1,196 @@
+/**************************************************************** anqread.h
+ * Binary output of the nilpotent quotient (option -B), and a reader
+ * that maps the file in memory and gives access to its contents
+ * without copying them. Usable from C and C++:
+ *
+ *   anq_file f;
+ *   if (anq_open(&f, "result.anq") != 0) perror("result.anq");
+ *   anq_vec v = anq_product(&f, 5, 2); // [a5,a2], or a5*a2
+ *   for (size_t k = 0; k < v.len; k++)
+ *     printf("%" PRId64 "*a%u\n", v.terms[k].coeff, v.terms[k].gen);
+ *   anq_close(&f);
+ *
+ * The file starts with an anq_header, followed by sections at the
+ * offsets given in the header, all 8-byte aligned. Integers are in
+ * the byte order of the machine that wrote the file.
+ *
+ * - generators: anq_generator[nrpcgens+1], entry 0 unused. The
+ *   definition, weight and relative order of each pc generator.
+ * - power, epimorphism, product: CSR row pointers into terms, of
+ *   length nrrows+1; row r is terms[ptr[r]..ptr[r+1]-1].
+ *   power has nrpcgens+1 rows (row 0 empty): Exponent[i]*ai = ...
+ *     (ai^Exponent[i] = ... in groups);
+ *   epimorphism has nrfpgens+1 rows (row 0 empty): the image of the
+ *     i-th fp generator;
+ *   product has one row per pair j > i >= 1, at index
+ *     (j-1)*(j-2)/2 + i-1, giving [aj,ai]; in associative algebras
+ *     it has one row per pair j, i >= 1, at index (j-1)*nrpcgens + i-1,
+ *     giving aj*ai.
+ * - terms: anq_term[nrterms], (generator, coefficient) pairs, sorted
+ *   by generator within each row. In groups, the coefficients are
+ *   exponents.
+ *
+ * Coefficients are integers, reduced to [0,P^K) when the ring is
+ * Z/P^K.
+ */
+
+#ifndef ANQREAD_H
+#define ANQREAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ANQ_MAGIC "ANQBIN\0\0"
+#define ANQ_VERSION 1
+
+enum anq_algebra { ANQ_LIE = 0, ANQ_GROUP = 1, ANQ_ASSOC = 2 };
+
+/* same values as the gendeftype's DGEN, DCOMM, DPOW */
+enum anq_deftype { ANQ_DGEN = 0, ANQ_DCOMM = 1, ANQ_DPOW = 2 };
+
+typedef struct {
+  char magic[8]; /* ANQ_MAGIC */
+  uint32_t version, algebra; /* ANQ_VERSION, anq_algebra */
+  uint64_t characteristic; /* coefficients are Z/characteristic^exponent, or Z if 0 */
+  uint32_t exponent, nilclass;
+  uint32_t nrpcgens, nrfpgens;
+  uint64_t generators, power, epimorphism, product, terms; /* section offsets */
+  uint64_t nrterms;
+  uint64_t size; /* of the whole file */
+} anq_header;
+
+typedef struct {
+  uint32_t type; /* anq_deftype */
+  uint32_t w, cw; /* weight and commutator weight */
+  uint32_t g, h; /* DGEN: fp generator g. DCOMM: [ag,ah], or ag*ah. DPOW: power of ag */
+  uint32_t reserved;
+  int64_t exponent; /* relative order, 0 if there is no torsion relation */
+} anq_generator;
+
+typedef struct {
+  uint32_t gen;
+  uint32_t reserved;
+  int64_t coeff;
+} anq_term;
+
+typedef struct {
+  const anq_term *terms;
+  size_t len;
+} anq_vec;
+
+typedef struct {
+  const anq_header *header;
+  const anq_generator *generators;
+  const uint64_t *power, *epimorphism, *product;
+  const anq_term *terms;
+} anq_file;
+
+static inline uint64_t anq_nrproducts(const anq_header *h) {
+  uint64_t n = h->nrpcgens;
+  return h->algebra == ANQ_ASSOC ? n*n : n*(n-(n>0))/2;
+}
+
+/* whether count items of size bytes fit at offset, 8-byte aligned,
+ * in a file of total bytes; without overflowing */
+static inline int anq_fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t total) {
+  return offset % 8 == 0 && offset <= total && count <= (total - offset) / size;
+}
+
+/* whether the row pointers ptr[0..n] never decrease, and stay within
+ * the terms */
+static inline int anq_rows_ok(const uint64_t *ptr, uint64_t n, uint64_t nrterms) {
+  for (uint64_t r = 0; r < n; r++)
+    if (ptr[r] > ptr[r+1])
+      return 0;
+  return ptr[n] <= nrterms;
+}
+
+/* map path in memory. Return 0 on success, -1 on failure, with
+ * errno set (EINVAL if the file is not in the right format) */
+static inline int anq_open(anq_file *f, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+  if ((size_t) st.st_size < sizeof(anq_header)) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+
+  void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    return -1;
+
+  const anq_header *h = (const anq_header *) p;
+  const char *base = (const char *) p;
+  uint64_t size = st.st_size;
+  int ok = !memcmp(h->magic, ANQ_MAGIC, sizeof h->magic)
+    && h->version == ANQ_VERSION
+    && h->size == size
+    && h->algebra <= ANQ_ASSOC
+    && anq_fits(h->generators, (uint64_t) h->nrpcgens+1, sizeof(anq_generator), size)
+    && anq_fits(h->power, (uint64_t) h->nrpcgens+2, sizeof(uint64_t), size)
+    && anq_fits(h->epimorphism, (uint64_t) h->nrfpgens+2, sizeof(uint64_t), size)
+    && anq_fits(h->product, anq_nrproducts(h)+1, sizeof(uint64_t), size)
+    && anq_fits(h->terms, h->nrterms, sizeof(anq_term), size);
+  if (ok) {
+    f->header = h;
+    f->generators = (const anq_generator *) (base + h->generators);
+    f->power = (const uint64_t *) (base + h->power);
+    f->epimorphism = (const uint64_t *) (base + h->epimorphism);
+    f->product = (const uint64_t *) (base + h->product);
+    f->terms = (const anq_term *) (base + h->terms);
+    ok = anq_rows_ok(f->power, (uint64_t) h->nrpcgens+1, h->nrterms)
+      && anq_rows_ok(f->epimorphism, (uint64_t) h->nrfpgens+1, h->nrterms)
+      && anq_rows_ok(f->product, anq_nrproducts(h), h->nrterms);
+  }
+  if (!ok) {
+    munmap(p, size);
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+static inline void anq_close(anq_file *f) {
+  munmap((void *) f->header, f->header->size);
+  f->header = NULL;
+}
+
+static inline anq_vec anq_row(const anq_file *f, const uint64_t *ptr, uint64_t r) {
+  anq_vec v = { f->terms + ptr[r], (size_t) (ptr[r+1] - ptr[r]) };
+  return v;
+}
+
+/* Exponent[i]*ai, or ai^Exponent[i] in groups, for 1 <= i <= nrpcgens */
+static inline anq_vec anq_power(const anq_file *f, unsigned i) {
+  return anq_row(f, f->power, i);
+}
+
+/* the image of fp generator i, for 1 <= i <= nrfpgens */
+static inline anq_vec anq_epimorphism(const anq_file *f, unsigned i) {
+  return anq_row(f, f->epimorphism, i);
+}
+
+/* [aj,ai] for nrpcgens >= j > i >= 1, or aj*ai in associative algebras */
+static inline anq_vec anq_product(const anq_file *f, unsigned j, unsigned i) {
+  if (f->header->algebra == ANQ_ASSOC)
+    return anq_row(f, f->product, (uint64_t) (j-1)*f->header->nrpcgens + i-1);
+  else
+    return anq_row(f, f->product, (uint64_t) (j-1)*(j-2)/2 + i-1);
+}
+
+#endif
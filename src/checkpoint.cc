@@ -0,0 +1,309 @@
+/**************************************************************** checkpoint.cc
+ * Save the pc presentation after each class, and resume from it.
+ *
+ * The file is binary, in the machine's byte order. It records the
+ * kind of algebra, the coefficient rings and the flags it was
+ * computed with, and a hash of the fp presentation; they must all
+ * match on resume. Coefficients are stored as mpz's (in the format
+ * of mpz_out_raw), so the file doesn't depend on how the ring is
+ * implemented; a checkpoint made with integer coefficients may be
+ * resumed with integers of another size.
+ */
+
+#include "nq.h"
+#include <unistd.h>
+
+BEGIN_NQ
+
+static const char CHECKPOINT_MAGIC[8] = { 'A', 'N', 'Q', 'C', 'K', 'P', 'T', '1' };
+
+/* a hash of the fp presentation, to make sure we resume with the
+ * same input. FNV-1a, over its printed form.
+ */
+static uint64_t fphash(const fppresentation &fp) {
+  char *buffer;
+  size_t len;
+  FILE *f = open_memstream(&buffer, &len);
+  if (f == nullptr)
+    abortprintf(1, "fphash: open_memstream() failed");
+
+  for (unsigned i = 1; i <= fp.NrGens; i++)
+    fprintf(f, "%s:%u,", fp.GeneratorName[i].c_str(), fp.Weight[i]);
+  for (const auto &list : { fp.Relators, fp.Aliases, fp.Endomorphisms }) {
+    fprintf(f, "|");
+    for (const node *n : list) {
+      fp.printnode(f, n);
+      fprintf(f, ",");
+    }
+  }
+  fclose(f);
+
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char) buffer[i];
+    hash *= 0x100000001b3ULL;
+  }
+  free(buffer);
+
+  return hash;
+}
+
+/****************************************************************
+ * low-level reading and writing
+ */
+static void put(FILE *f, const void *p, size_t len) {
+  if (fwrite(p, 1, len, f) != len)
+    abortprintf(1, "I can't write to checkpoint file: %s", strerror(errno));
+}
+
+static void get(FILE *f, void *p, size_t len) {
+  if (fread(p, 1, len, f) != len)
+    abortprintf(1, "Checkpoint file is truncated");
+}
+
+static void putuint(FILE *f, uint64_t n) { put(f, &n, sizeof n); }
+
+static uint64_t getuint(FILE *f) { uint64_t n; get(f, &n, sizeof n); return n; }
+
+static void putstring(FILE *f, const char *s) {
+  putuint(f, strlen(s));
+  put(f, s, strlen(s));
+}
+
+static std::string getstring(FILE *f) {
+  std::string s(getuint(f), 0);
+  get(f, &s[0], s.size());
+  return s;
+}
+
+static void putcoeff(FILE *f, const pccoeff &c) {
+  integer<0,0> z;
+  z.init();
+  map(z, c);
+  if (z.out_raw(f) == 0)
+    abortprintf(1, "I can't write to checkpoint file: %s", strerror(errno));
+  z.clear();
+}
+
+static void getcoeff(FILE *f, pccoeff &c) {
+  integer<0,0> z;
+  z.init();
+  if (z.inp_raw(f) == 0)
+    abortprintf(1, "Checkpoint file is truncated");
+  try {
+    map(c, z);
+  } catch (const coeff_overflow &) {
+    z.clear();
+    throw coeff_overflow(std::string("Checkpoint has coefficients that don't fit in ") + pccoeff::COEFF_ID());
+  }
+  z.clear();
+}
+
+static void putvec(FILE *f, const sparsepcvec &v) {
+  if (!v.allocated()) {
+    putuint(f, -1);
+    return;
+  }
+  putuint(f, v.size());
+  for (const auto &kc : v) {
+    putuint(f, kc.first);
+    putcoeff(f, kc.second);
+  }
+}
+
+static sparsepcvec getvec(FILE *f) {
+  uint64_t len = getuint(f);
+  sparsepcvec v;
+  if (len == (uint64_t) -1) {
+    v.noalloc();
+    return v;
+  }
+  v.alloc(len);
+  for (unsigned i = 0; i < len; i++) {
+    v[i].first = getuint(f);
+    getcoeff(f, v[i].second);
+  }
+  v.truncate(len);
+  return v;
+}
+
+/* integers of any size can be converted into each other */
+static bool samering(const std::string &s, const char *id) {
+  static const char INTEGERS[] = "ℤ as ";
+  return s == id || (!s.compare(0, sizeof INTEGERS-1, INTEGERS) && !strncmp(id, INTEGERS, sizeof INTEGERS-1));
+}
+
+static uint64_t flagbits(const pcpresentation &pc) {
+  return pc.Graded | pc.Metabelian << 1 | pc.Jacobson << 2 | pc.Jennings << 3 | pc.TorsionFree << 4;
+}
+
+/****************************************************************
+ * save the presentation, at the end of a class, in filename
+ */
+void pcpresentation::savecheckpoint(const char *filename) const {
+  std::string tmpname = std::string(filename) + ".tmp";
+  FILE *f = fopen(tmpname.c_str(), "w");
+  if (f == nullptr)
+    abortprintf(1, "I can't open checkpoint file '%s'", tmpname.c_str());
+
+  savecheckpoint(f);
+
+  // on disk before it replaces the old checkpoint, in case we crash
+  if (fflush(f) != 0 || fsync(fileno(f)) != 0 || fclose(f) != 0)
+    abortprintf(1, "I can't write to checkpoint file: %s", strerror(errno));
+  if (rename(tmpname.c_str(), filename) != 0)
+    abortprintf(1, "I can't rename checkpoint file to '%s': %s", filename, strerror(errno));
+
+  TimeStamp("pcpresentation::savecheckpoint()");
+}
+
+void pcpresentation::savecheckpoint(FILE *f) const {
+  put(f, CHECKPOINT_MAGIC, sizeof CHECKPOINT_MAGIC);
+  putstring(f, LIEGPSTRING);
+  putstring(f, pccoeff::COEFF_ID());
+  putstring(f, matcoeff::COEFF_ID());
+  putuint(f, fphash(fp));
+  putuint(f, flagbits(*this));
+  putuint(f, NilpotencyClass);
+
+  putuint(f, Class);
+  putuint(f, NrPcGens);
+  putuint(f, fp.NrGens);
+
+  putuint(f, LastGen.size());
+  for (unsigned g : LastGen)
+    putuint(f, g);
+
+  for (unsigned i = 1; i <= NrPcGens; i++) {
+    putuint(f, Generator[i].type);
+    putuint(f, Generator[i].w);
+    putuint(f, Generator[i].cw);
+    putuint(f, Generator[i].a.g);
+    putuint(f, Generator[i].a.h);
+    putcoeff(f, Exponent[i]);
+    putcoeff(f, Annihilator[i]);
+    putvec(f, Power[i]);
+  }
+
+  for (unsigned i = 1; i <= fp.NrGens; i++)
+    putvec(f, Epimorphism[i]);
+
+  for (unsigned i = 1; i <= NrPcGens; i++)
+#ifdef ASSOCALG
+    for (unsigned j = 1; j <= NrPcGens; j++)
+      putvec(f, Prod[i][j]);
+#else
+    for (unsigned j = 1; j < i; j++)
+      putvec(f, Comm[i][j]);
+#endif
+
+  put(f, CHECKPOINT_MAGIC, sizeof CHECKPOINT_MAGIC);
+}
+
+/****************************************************************
+ * restore a presentation from filename. It must have just been
+ * created, from the same fp presentation and with the same flags.
+ * Throws coeff_overflow if the coefficients don't fit in pccoeff; pc
+ * should then be discarded.
+ */
+void pcpresentation::loadcheckpoint(const char *filename) {
+  FILE *f = fopen(filename, "r");
+  if (f == nullptr)
+    abortprintf(1, "I can't open checkpoint file '%s'", filename);
+
+  loadcheckpoint(f, filename);
+  fclose(f);
+
+  TimeStamp("pcpresentation::loadcheckpoint()");
+}
+
+void pcpresentation::loadcheckpoint(FILE *f, const char *filename) {
+  char magic[sizeof CHECKPOINT_MAGIC];
+  get(f, magic, sizeof magic);
+  if (memcmp(magic, CHECKPOINT_MAGIC, sizeof magic))
+    abortprintf(1, "'%s' is not a checkpoint file", filename);
+
+  std::string s = getstring(f);
+  if (s != LIEGPSTRING)
+    abortprintf(1, "Checkpoint was computed for a %s, not a %s", s.c_str(), LIEGPSTRING);
+  s = getstring(f);
+  if (!samering(s, pccoeff::COEFF_ID()))
+    abortprintf(1, "Checkpoint was computed with coefficients %s, not %s", s.c_str(), pccoeff::COEFF_ID());
+  s = getstring(f);
+  if (!samering(s, matcoeff::COEFF_ID()))
+    abortprintf(1, "Checkpoint was computed with matrix coefficients %s, not %s", s.c_str(), matcoeff::COEFF_ID());
+  if (getuint(f) != fphash(fp))
+    abortprintf(1, "Checkpoint was computed from a different presentation");
+  if (getuint(f) != flagbits(*this) || getuint(f) != NilpotencyClass)
+    abortprintf(1, "Checkpoint was computed with different flags");
+
+  if (NrPcGens != 0)
+    abortprintf(5, "loadcheckpoint: presentation is not empty");
+
+  try {
+    Class = getuint(f);
+    NrPcGens = getuint(f);
+    if (getuint(f) != fp.NrGens)
+      abortprintf(1, "Checkpoint was computed from a different presentation");
+
+    LastGen.resize(getuint(f));
+    for (unsigned &g : LastGen)
+      g = getuint(f);
+
+    Generator.resize(NrPcGens + 1);
+    Exponent.resize(NrPcGens + 1);
+    Annihilator.resize(NrPcGens + 1);
+    Power.resize(NrPcGens + 1);
+    for (unsigned i = 1; i <= NrPcGens; i++) {
+      Generator[i].type = (gendeftype) getuint(f);
+      Generator[i].w = getuint(f);
+      Generator[i].cw = getuint(f);
+      Generator[i].a.g = getuint(f);
+      Generator[i].a.h = getuint(f);
+      Exponent[i].init();
+      getcoeff(f, Exponent[i]);
+      Annihilator[i].init();
+      getcoeff(f, Annihilator[i]);
+      Power[i] = getvec(f);
+    }
+
+    for (unsigned i = 1; i <= fp.NrGens; i++) {
+      sparsepcvec v = getvec(f);
+      Epimorphism[i].free();
+      Epimorphism[i] = v;
+    }
+
+#ifdef ASSOCALG
+    Prod.resize(NrPcGens + 1);
+    Prod[0].resize(NrPcGens + 1);
+    for (unsigned i = 1; i <= NrPcGens; i++) {
+      Prod[i].resize(NrPcGens + 1);
+      Prod[i][0].alloc(1);
+      Prod[i][0][0].first = i;
+      set_si(Prod[i][0][0].second, 1);
+      Prod[i][0].truncate(1);
+      Prod[0][i] = Prod[i][0];
+    }
+    for (unsigned i = 1; i <= NrPcGens; i++)
+      for (unsigned j = 1; j <= NrPcGens; j++)
+	Prod[i][j] = getvec(f);
+#else
+    Comm.resize(NrPcGens + 1);
+    for (unsigned i = 1; i <= NrPcGens; i++) {
+      Comm[i].resize(i);
+      Comm[i][0] = sparsepcvec::bad(); // guard
+      for (unsigned j = 1; j < i; j++)
+	Comm[i][j] = getvec(f);
+    }
+#endif
+  } catch (const coeff_overflow &) {
+    NrPcGens = 0; // the vectors read so far are lost
+    throw;
+  }
+
+  get(f, magic, sizeof magic);
+  if (memcmp(magic, CHECKPOINT_MAGIC, sizeof magic))
+    abortprintf(1, "Checkpoint file '%s' is corrupt", filename);
+}
+
+END_NQ
@@ -10,6 +10,8 @@
 #include <stdio.h>
 #include <stdarg.h>
 
+BEGIN_NQ
+
 const gen LASTGEN = -1u;
 
 enum token {
@@ -76,31 +78,19 @@ static FILE *InFp;	/* Current input file pointer. */
 static fpcoeff N;	/* Contains the integer just read. */
 static std::string GenName; /* Contains the generator name. */
 
+static char Ch;		/* Lookahead character, or 0. */
+
+/* report an error in the presentation; if it is being parsed, say where */
 static void SyntaxError(const char *format, ...) __attribute__((format(__printf__, 1, 2),noreturn));
 static void SyntaxError(const char *format, ...) {
+  char message[1000];
   va_list va;
   va_start (va, format);
-  vfprintf(stderr, format, va);
-  fprintf(stderr, " in file %s, line %d, char %d\n%s\n%*s", InFileName, TLine, TColumn, CurLine.c_str(), TColumn, "^");
-  exit(3);
-}
-
-void FreeNode(node *n) {
-  switch (n->type) {
-  case TGEN:
-    break;
-  case TNUM:
-    n->n.clear();
-    break;
-  default:
-    if (is_unary(n->type))
-      FreeNode(n->u);
-    else {
-      FreeNode(n->l);
-      FreeNode(n->r);
-    }
-  }
-  delete n;
+  vsnprintf(message, sizeof message, format, va);
+  va_end(va);
+  if (InFp == nullptr)
+    abortprintf(3, "%s", message);
+  abortprintf(3, "%s in file %s, line %d, char %d\n%s\n%*s", message, InFileName, TLine, TColumn, CurLine.c_str(), TColumn, "^");
 }
 
 static gen GetGen(fppresentation &pres) {
@@ -141,8 +131,6 @@ static char ReadCh() {
    Also sets the globals GenName and N in case a generator / number is read.
 */
 static void NextToken() {
-  static char Ch = '\0';
-  
   /* skip blanks */
   if (Ch == '\0')
     Ch = ReadCh();
@@ -335,7 +323,7 @@ node *Term(fppresentation &pres) {
 	abortprintf(3, "I can't evaluate a numerical expression with unary operator %s", nodename[n->type]);
       }
       n->type = TNUM;
-      FreeNode(u);
+      delete u;
     } else
       n->u = u;
     return n;
@@ -390,7 +378,7 @@ node *Expression(fppresentation &pres, unsigned precedence) {
 
 #ifdef LIEALG
     if (oper == TPOW && u->type == TGEN && u->g == 0) { // p-power mapping
-      FreeNode(u);
+      delete u;
       t = new node{TFROB, t};
       continue;
     }
@@ -412,7 +400,7 @@ node *Expression(fppresentation &pres, unsigned precedence) {
       default:
 	abortprintf(3, "I can't evaluate a numerical expression with binary operator %d", oper);
       }
-      FreeNode(u);
+      delete u;
     } else {
       if (oper == TPROD && t->type == TNUM)
 	oper = TSPROD;
@@ -513,148 +501,185 @@ void ValidateMap(const node *n, const fppresentation &pres, std::vector<bool> &s
   seen[v->g] = true;
 }
 
-fppresentation::fppresentation(const char *InputFileName, bool ppower) {
-  if (InputFileName == nullptr) {
-    InFileName = "<stdin>";
-    InFp = stdin;
-  } else {
-    InFileName = InputFileName;
-    InFp = fopen(InputFileName, "r");
-    if (InFp == NULL)
-      abortprintf(1, "Can't open input file '%s'", InputFileName);
-  }
-
+/* an empty presentation, to be filled with addgen() and addrel() */
+fppresentation::fppresentation(bool ppower) {
   NrGens = 0;
 
   Weight.resize(1); // we start indexing at 1
   GeneratorName.resize(1);
   if (ppower)
     GeneratorName[0] = "p";
-  
+}
+
+/* the presentation in file InputFileName, or stdin if nullptr */
+fppresentation::fppresentation(const char *InputFileName, bool ppower) : fppresentation(ppower) {
+  if (InputFileName == nullptr) {
+    parse(stdin, "<stdin>");
+    return;
+  }
+
+  FILE *f = fopen(InputFileName, "r");
+  if (f == NULL)
+    abortprintf(1, "Can't open input file '%s'", InputFileName);
+  try {
+    parse(f, InputFileName);
+  } catch (...) {
+    fclose(f);
+    throw;
+  }
+  fclose(f);
+}
+
+/* the presentation read from f, which is called name in error messages */
+fppresentation::fppresentation(FILE *f, const char *name, bool ppower) : fppresentation(ppower) {
+  parse(f, name);
+}
+
+/* add a generator of given weight, and return its number */
+gen fppresentation::addgen(const std::string &name, unsigned weight) {
+  // we start at 0, including the special name "p" at position 0, to recognize p-powers
+  for (unsigned i = 0; i <= NrGens; i++) {
+    if (name == GeneratorName[i])
+      SyntaxError("Duplicate generator %s", name.c_str());
+  }
+  if (weight == 0)
+    SyntaxError("Weight of generator %s should be positive", name.c_str());
+
+  NrGens++;
+  GeneratorName.push_back(name);
+  Weight.push_back(weight);
+
+  return NrGens;
+}
+
+/* add a relation, alias (g := expr) or endomorphism ({g -> expr,...}).
+   The presentation takes ownership of n. */
+void fppresentation::addrel(node *n) {
+  if (n->type == TDRELR) { /* switch sides */
+    n->type = TDREL;
+    std::swap(n->l,n->r);
+  }
+    
+  if (n->type == TREL) { /* chains of equalities */
+    node *t;
+    for (t = n; t->type == TREL; t = t->l)
+      ValidateExpression(t->r, LASTGEN);
+    ValidateExpression(t, LASTGEN);
+  } else if (n->type == TDREL) {
+    if (n->l->type != TGEN)
+      SyntaxError("LHS should be generator, not %s", nodename[n->l->type]);
+
+    if (!Aliases.empty() && Aliases.back()->l->g >= n->l->g)
+      SyntaxError("Definitions are not in increasing order at generator %s", GeneratorName[n->l->g].c_str());
+      
+    ValidateExpression(n->r, n->l->g);
+  } else if (n->type == TBRACE || n->type == TMAP) {
+    std::vector<bool> seen(NrGens+1,false);
+    node *t;
+    for (t = n; t->type == TBRACE; t = t->l)
+      ValidateMap(t->r, *this, seen);
+    ValidateMap(t, *this, seen);
+
+    for (const auto &n : Aliases)
+      seen[n->l->g] = true; // don't force aliases to be defined
+
+    for (unsigned i = 1; i <= NrGens; i++)
+      if (!seen[i])
+	SyntaxError("Map doesn't specify image of generator %s", GeneratorName[i].c_str());
+  } else
+    ValidateExpression(n, LASTGEN);
+
+  if (Debug >= 3) {
+    fprintf(LogFile, "# ");
+    printnode(LogFile, n);
+    fprintf(LogFile,"\n");
+  }
+
+  switch (n->type) {
+  case TDREL:
+    Aliases.push_back(n);
+    break;
+  case TBRACE: case TMAP:
+    Endomorphisms.push_back(n);
+    break;
+  default:
+    Relators.push_back(n);
+  }
+}
+
+void fppresentation::parse(FILE *f, const char *name) {
+  InFileName = name;
+  InFp = f;
+  Ch = '\0';
   Column = 0;
   CurLine = "";
   Line = 1;
   N.init();
-  
-  NextToken(); // start parsing
-  if (Token != LANGLE)
-    SyntaxError("'<' expected");
 
-  unsigned weight = 1;
+  try {
+    NextToken(); // start parsing
+    if (Token != LANGLE)
+      SyntaxError("'<' expected");
 
-  NextToken();
-  /* get generators */
-  while (true) {
-    while (true) {
-      if (Token != SEMICOLON)
-	break;
-      NextToken();
-      weight++;
-    }
-    if (Token == PIPE)
-      break;
+    unsigned weight = 1;
 
+    NextToken();
+    /* get generators */
     while (true) {
-      if (Token != GEN)
-	SyntaxError("Generator expected");
-
-      // we start at 0, including the special name "p" at position 0, to recognize p-powers
-      for (unsigned i = 0; i <= NrGens; i++) {
-	if (GenName == GeneratorName[i])
-	  SyntaxError("Duplicate generator %s", GenName.c_str());
+      while (true) {
+	if (Token != SEMICOLON)
+	  break;
+	NextToken();
+	weight++;
       }
+      if (Token == PIPE)
+	break;
+
+      while (true) {
+	if (Token != GEN)
+	  SyntaxError("Generator expected");
 
-      NrGens++;
-      GeneratorName.resize(NrGens + 1);
-      GeneratorName[NrGens].assign(GenName);
-      Weight.resize(NrGens + 1);
+	gen g = addgen(GenName, weight);
       
-      NextToken();
-      if (Token == POWER) {
 	NextToken();
-	node *t = Term(*this);
-	if (t->type != TNUM)
-	  SyntaxError("Number expected as weight of generator %s", GenName.c_str());
-	int w = t->n.get_si();
-	if (w <= 0)
-	  SyntaxError("Weight of generator %s should be positive, not %d", GenName.c_str(), w);
-	Weight[NrGens] = w;
-      } else
-	Weight[NrGens] = weight;
+	if (Token == POWER) {
+	  NextToken();
+	  node *t = Term(*this);
+	  if (t->type != TNUM)
+	    SyntaxError("Number expected as weight of generator %s", GeneratorName[g].c_str());
+	  int w = t->n.get_si();
+	  if (w <= 0)
+	    SyntaxError("Weight of generator %s should be positive, not %d", GeneratorName[g].c_str(), w);
+	  Weight[g] = w;
+	}
       
-      if (Token != COMMA)
-	break;
-      NextToken();
+	if (Token != COMMA)
+	  break;
+	NextToken();
+      }
     }
-  }
     
-  NextToken();
-  /* get relators */
-  while (is_relation(Token)) {
-    node *n = Expression(*this, 0);
-
-    if (n->type == TDRELR) { /* switch sides */
-      n->type = TDREL;
-      std::swap(n->l,n->r);
-    }
+    NextToken();
+    /* get relators */
+    while (is_relation(Token)) {
+      addrel(Expression(*this, 0));
     
-    if (n->type == TREL) { /* chains of equalities */
-      node *t;
-      for (t = n; t->type == TREL; t = t->l)
-	ValidateExpression(t->r, LASTGEN);
-      ValidateExpression(t, LASTGEN);
-    } else if (n->type == TDREL) {
-      if (n->l->type != TGEN)
-	SyntaxError("LHS should be generator, not %s", nodename[n->l->type]);
-
-      if (!Aliases.empty() && Aliases.back()->l->g >= n->l->g)
-	SyntaxError("Definitions are not in increasing order at generator %s", GeneratorName[n->l->g].c_str());
-      
-      ValidateExpression(n->r, n->l->g);
-    } else if (n->type == TBRACE || n->type == TMAP) {
-      std::vector<bool> seen(NrGens+1,false);
-      node *t;
-      for (t = n; t->type == TBRACE; t = t->l)
-	ValidateMap(t->r, *this, seen);
-      ValidateMap(t, *this, seen);
-
-      for (const auto &n : Aliases)
-	seen[n->l->g] = true; // don't force aliases to be defined
-
-      for (unsigned i = 1; i <= NrGens; i++)
-	if (!seen[i])
-	  SyntaxError("Map doesn't specify image of generator %s", GeneratorName[i].c_str());
-    } else
-      ValidateExpression(n, LASTGEN);
-
-    if (Debug >= 3) {
-      fprintf(LogFile, "# ");
-      printnode(LogFile, n);
-      fprintf(LogFile,"\n");
+      if (Token == COMMA)
+	NextToken();
+      else
+	break;
     }
 
-    switch (n->type) {
-    case TDREL:
-      Aliases.push_back(n);
-      break;
-    case TBRACE: case TMAP:
-      Endomorphisms.push_back(n);
-      break;
-    default:
-      Relators.push_back(n);
-    }
-    
-    if (Token == COMMA)
-      NextToken();
-    else
-      break;
+    if (Token != RANGLE)
+      SyntaxError("'>' expected");
+  } catch (...) {
+    InFp = nullptr;
+    N.clear();
+    throw;
   }
 
-  if (Token != RANGLE)
-    SyntaxError("'>' expected");
-
-  if (InputFileName != nullptr)
-    fclose(InFp);
+  InFp = nullptr;
+  N.clear();
 
   if (Debug >= 2) {
     fprintf(LogFile, "# generators:");
@@ -677,8 +702,6 @@ fppresentation::fppresentation(const char *InputFileName, bool ppower) {
     }
     fprintf(LogFile, "\n");
   }
-  
-  N.clear();
 }
 
 fppresentation::~fppresentation() {
@@ -806,3 +829,5 @@ void fppresentation::printnode(FILE *f, const node *n) const {
     abortprintf(3, "printnode: Illegal node of type %s", nodename[n->type]);
   }
 }
+
+END_NQ
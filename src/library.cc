@@ -0,0 +1,162 @@
+/**************************************************************** library.cc
+ * what the nq program and the nq library share: global settings,
+ * error reporting, timing and statistics, and printing of coefficients
+ * and vectors.
+ */
+
+#include "nq.h"
+#include <string.h>
+#include <stdarg.h>
+#include <stdexcept>
+#include <sys/resource.h>
+
+BEGIN_NQ
+
+FILE *LogFile = stdout, *StatsFile = nullptr;
+unsigned Debug = 0;
+unsigned NrThreads = 1;
+size_t MatrixMemory = 0;
+const char *SpillDirectory = nullptr;
+bool MarkowitzPivots = true;
+bool SizeReduce = false;
+bool ThrowOnAbort = false;
+
+void abortprintf(int errorcode, const char *format, ...) {
+  va_list ap;
+  va_start(ap, format);
+  char *message;
+#ifndef NO_TRIO
+  if (trio_vasprintf(&message, format, ap) < 0)
+#else
+  if (vasprintf(&message, format, ap) < 0)
+#endif
+    message = nullptr;
+  va_end(ap);
+
+  std::string s(message != nullptr ? message : format);
+  free(message);
+
+  if (ThrowOnAbort)
+    throw std::runtime_error(s);
+
+  fprintf(stderr, "%s\n", s.c_str());
+  if (LogFile != stdout)
+    fprintf(LogFile, "%s\n", s.c_str());
+  
+  exit(errorcode);
+}
+
+void TimeStamp(const char *s) {
+  static clock_t lastclock = 0;
+
+  if (Debug) {
+    clock_t newclock = clock();
+    fprintf(LogFile, "# %s finished, %.3gs\n", s, (newclock-lastclock) / (float)CLOCKS_PER_SEC);
+    fflush(LogFile);
+    lastclock = newclock;
+  }
+}
+
+statistics Stats;
+
+// write a JSON line to StatsFile, with the resources used since the
+// last record and the counters in Stats, and reset them. The first
+// call only starts the clocks.
+void StatsRecord(unsigned weight, const char *phase) {
+  static struct timespec lastwall;
+  static clock_t lastclock;
+  static bool started = false;
+
+  struct timespec wall;
+  clock_gettime(CLOCK_MONOTONIC, &wall);
+  clock_t cpu = clock();
+
+  if (StatsFile != nullptr && started) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    long maxrss = usage.ru_maxrss;
+#ifdef __APPLE__
+    maxrss /= 1024; // in bytes, not kilobytes
+#endif
+
+    fprintf(StatsFile, "{\"class\":%u,\"phase\":\"%s\",\"wall\":%.6f,\"cpu\":%.6f,\"maxrss_kb\":%ld,"
+	    "\"newgens\":%" PRIu64 ",\"queued\":%" PRIu64 ",\"duplicates\":%" PRIu64 ",\"nnzbefore\":%" PRIu64 ",\"nnzafter\":%" PRIu64 ",\"keptrows\":%" PRIu64 ",\"eliminated\":%" PRIu64 "}\n",
+	    weight, phase,
+	    (wall.tv_sec - lastwall.tv_sec) + (wall.tv_nsec - lastwall.tv_nsec) * 1e-9,
+	    (cpu - lastclock) / (double) CLOCKS_PER_SEC,
+	    maxrss,
+	    Stats.newgens, Stats.queued, Stats.duplicates, Stats.nnzbefore, Stats.nnzafter, Stats.keptrows, Stats.eliminated);
+    fflush(StatsFile);
+  }
+
+  Stats = statistics();
+  lastwall = wall;
+  lastclock = cpu;
+  started = true;
+}
+
+#ifndef NO_TRIO
+template <typename T> static int coeff_print(void *ref)
+{
+  T *data = (T *) trio_get_argument(ref);
+  if (data == nullptr)
+    return -1;
+  char *buffer = (char *) get_str(nullptr, 0, 10, *data);
+  trio_print_string(ref, buffer);
+  int len = strlen(buffer);
+  free(buffer);
+  return len;
+}  
+
+template <typename V> static int cvec_print(void *ref)
+{
+  V *data = (V *) trio_get_argument(ref);
+  if (data == nullptr)
+    return -1;
+
+  bool first = true;
+  for (const auto &kc : *data) {
+    char *buffer = (char *) get_str(nullptr, 0, 10, kc.second);
+#ifdef GROUP
+    if (first) first = false; else trio_print_string(ref, " * ");
+    trio_print_string(ref, "a");
+    trio_print_int(ref, kc.first);
+    trio_print_string(ref, "^");
+    trio_print_string(ref, buffer);
+#else
+    if (first) first = false; else trio_print_string(ref, " + ");
+    trio_print_string(ref, buffer);
+    trio_print_string(ref, "*a");
+    trio_print_int(ref, kc.first);
+#endif
+    free(buffer);
+  }
+  return 0;
+}  
+#endif
+
+/* make coefficients and vectors printable as PRIpccoeff etc. */
+#ifndef NO_TRIO
+static trio_pointer_t handle_pccoeff, handle_sparsepcvec, handle_sparsematvec, handle_hollowpcvec;
+#endif
+
+void RegisterPrinters() {
+#ifndef NO_TRIO
+  handle_pccoeff = trio_register(coeff_print<pccoeff>, "c%p"); // coeffs can be printed as PRIpccoeff
+  handle_sparsepcvec = trio_register(cvec_print<sparsepcvec>, "s%p"); // sparsepcvecs can be printed as PRIsparsepcvec
+  handle_sparsematvec = trio_register(cvec_print<sparsematvec>, "m%p"); // sparsematvecs can be printed as PRIsparsematvec
+  handle_hollowpcvec = trio_register(cvec_print<hollowpcvec>, "h%p"); // hollowpcvecs can be printed as PRIhollowpcvec
+#endif
+}
+
+void UnregisterPrinters() {
+#ifndef NO_TRIO
+  trio_unregister(handle_hollowpcvec);
+  trio_unregister(handle_sparsematvec);
+  trio_unregister(handle_sparsepcvec);
+  trio_unregister(handle_pccoeff);
+#endif
+}
+
+END_NQ
@@ -6,11 +6,15 @@
 */
 
 #include "nq.h"
+#include "spill.hh"
 #include "colamd.h"
 #include <algorithm>
+#include <exception>
 #include <utility>
 #include <unistd.h>
 
+BEGIN_NQ
+
 #ifdef HACK_to_allow_pointer_to_be_changed_in_set
 // @@@ this experiment was to hack into the std::set by allowing a
 // temp. to be used for searching, and then replacing it by a
@@ -31,13 +35,21 @@ and "Queue.insert(cv);" should become
 }
 #endif
 
-matrix::matrix(unsigned _nrcols, unsigned _shift, bool _torsionfree) : nrcols(_nrcols), shift(_shift), torsionfree(_torsionfree) {
+typedef integer<0,0> bigcoeff; // for exact computations, and to write coefficients
+
+matrix::matrix(unsigned _nrcols, unsigned _shift, bool _torsionfree) : nrcols(_nrcols), shift(_shift), torsionfree(_torsionfree), queuebytes(0), spillfile(nullptr), fullcols(0) {
   rows.resize(nrcols, sparsematvec::null());
   rowstack.setsize(nrcols);
 }
 
 matrix::~matrix() {
-  if (!queue.empty())
+  if (std::uncaught_exception()) { // e.g. coefficient overflow, the queue is abandoned
+    for (sparsematvec v : queue)
+      v.free();
+    queue.clear();
+    closespill();
+  }
+  if (!queue.empty() || !spilled.empty())
     abortprintf(5, "matrix::~matrix: row queue not empty");
 
   for (sparsematvec v : rows)
@@ -48,9 +60,15 @@ matrix::~matrix() {
 // put v in normal form by subtracting rows of Matrix, return in fresh vector
 // !!! this is time-critical. Optimize!
 sparsepcvec matrix::reducerow(const sparsepcvec &v) const {
+  // reducerow() may be called from several threads at once, so it
+  // can't use the shared rowstack
+  static thread_local vec_supply<hollowmatvec> reducestack;
+  if (reducestack.getsize() != nrcols)
+    reducestack.setsize(nrcols);
+  
   matcoeff q;
   q.init();
-  hollowmatvec hv = rowstack.fresh();
+  hollowmatvec hv = reducestack.fresh();
 
   for (auto &kc : v)
     map(hv[kc.first-shift], kc.second);
@@ -75,16 +93,297 @@ sparsepcvec matrix::reducerow(const sparsepcvec &v) const {
   }
   ri.markend();
 
-  rowstack.release(hv);
+  reducestack.release(hv);
   q.clear();
 
   return r;
 }
 
+// free rows[j], unless flushqueue() still needs it, and unset it
+void matrix::droprow(unsigned j) {
+  if (saved.empty() || !rows[j].is_identical(saved[j]))
+    rows[j].free();
+  rows[j] = sparsematvec::null();
+}
+
+#if MATCOEFF_P == 0
+static const int64_t SIZEREDUCE_BOUND = 1LL << 20; // entries beyond which rows are size-reduced
+
+/* whether v has entries beyond SIZEREDUCE_BOUND */
+template<typename V> static bool large(const V &v) {
+  for (const auto &kc : v)
+    if (kc.second.cmp_si(SIZEREDUCE_BOUND) > 0 || kc.second.cmp_si(-SIZEREDUCE_BOUND) < 0)
+      return true;
+  return false;
+}
+
+/* with SizeReduce, shorten v by the pivot rows w after from: subtract
+   from v the nearest integer to <v,w>/<w,w> times w, which minimizes
+   the norm of the result (pairwise reduction, as in LLL). This keeps
+   the entries small in all columns, not only in pivot columns; the
+   Hermite form at the end is the same */
+void matrix::sizereduce(hollowmatvec &v, unsigned from) {
+  bigcoeff dot, norm, x, y;
+  dot.init();
+  norm.init();
+  x.init();
+  y.init();
+  matcoeff q;
+  q.init();
+  for (const auto &kc : v) {
+    unsigned k = kc.first;
+    if (k <= from || !rows[k].allocated())
+      continue;
+    const sparsematvec w = rows[k];
+    dot.zero();
+    norm.zero();
+    auto wi = w.begin();
+    for (const auto &vc : v) {
+      if (vc.first < k)
+	continue;
+      while (wi != w.end() && wi->first < vc.first)
+	++wi;
+      if (wi == w.end())
+	break;
+      if (wi->first == vc.first) {
+	map(x, vc.second);
+	map(y, wi->second);
+	dot.addmul(x, y);
+      }
+    }
+    for (const auto &wc : w) {
+      map(x, wc.second);
+      norm.addmul(x, x);
+    }
+    fdiv_qr(x, y, dot, norm);
+    dot.sub(norm, y);
+    if (y.cmp(dot) > 0) // round to nearest
+      x.add_si(x, 1);
+    if (x.nz_p()) {
+      map(q, x);
+      v.submul(q, w);
+    }
+  }
+  q.clear();
+  y.clear();
+  x.clear();
+  norm.clear();
+  dot.clear();
+}
+
+/* the same, for the pivot row j */
+void matrix::sizereduce(unsigned j) {
+  if (!large(rows[j]))
+    return;
+  hollowmatvec v = rowstack.fresh();
+  v.copy(rows[j]);
+  sizereduce(v, j);
+  droprow(j);
+  rows[j] = v.getsparse();
+  rowstack.release(v);
+}
+#endif
+
+#if MATCOEFF_P > 0 && MATCOEFF_K == 1 && MATCOEFF_P < (1ULL << 32)
+#define LAZYFIELD
+/****************************************************************
+ * elimination over a prime field.
+ *
+ * All pivots are 1, so reducing a row at column j just adds a
+ * multiple of rows[j]. The row is kept as a dense array of sums of
+ * products, reduced mod p only when their column is reached; since
+ * p < 2^32, they can't overflow. A bitmap records which columns may
+ * be non-zero, so that they're visited in order.
+ */
+class lazyrow {
+  typedef unsigned __int128 lazysum;
+  std::vector<lazysum> sum;
+  std::vector<uint64_t> bits;
+  size_t count; // number of bits set
+
+  void add(unsigned k, lazysum s) {
+    sum[k] += s;
+    uint64_t b = 1ULL << (k % 64);
+    if (!(bits[k/64] & b))
+      bits[k/64] |= b, count++;
+  }
+
+public:
+  void setsize(unsigned n) { sum.assign(n, 0); bits.assign((n+63)/64, 0); count = 0; }
+  unsigned size() const { return sum.size(); }
+  size_t population() const { return count; }
+
+  template<typename V> void load(const V &v) {
+    matcoeff one;
+    one.init();
+    one.set_si(1);
+    for (const auto &kc : v)
+      add(kc.first, lazymul(kc.second, one));
+    one.clear();
+  }
+
+  // add m*v
+  void addmul(const matcoeff &m, const sparsematvec &v) {
+    for (const auto &kc : v)
+      add(kc.first, lazymul(m, kc.second));
+  }
+
+  // the first column >= j that may be non-zero, or size()
+  unsigned next(unsigned j) const {
+    unsigned w = j / 64;
+    if (count == 0 || w >= bits.size())
+      return size();
+    uint64_t b = bits[w] & (~0ULL << (j % 64));
+    while (!b) {
+      if (++w == bits.size())
+	return size();
+      b = bits[w];
+    }
+    return w*64 + __builtin_ctzll(b);
+  }
+
+  void get(unsigned j, matcoeff &c) const { c.reduce_lazy(sum[j]); }
+
+  void drop(unsigned j) {
+    sum[j] = 0;
+    bits[j/64] &= ~(1ULL << (j % 64));
+    count--;
+  }
+
+  // move the entries from column j on into a sparse vector, times q
+  sparsematvec extract(unsigned j, const matcoeff &q) {
+    sparsematvec v;
+    v.alloc(count);
+    unsigned len = 0;
+    matcoeff c;
+    c.init();
+    for (unsigned k = next(j); k < size(); k = next(k+1)) {
+      get(k, c);
+      drop(k);
+      if (c.nz_p()) {
+	v[len].first = k;
+	v[len++].second.mul(c, q);
+      }
+    }
+    v.truncate(len);
+    c.clear();
+    return v;
+  }
+};
+
+/* whether v has more than n entries */
+static bool longer(const sparsematvec &v, size_t n) {
+  for (auto kc __attribute__((unused)) : v)
+    if (n-- == 0)
+      return true;
+  return false;
+}
+
+// add1row(), below, with currow held in a lazyrow
+bool matrix::add1row(hollowmatvec currow, unsigned end) {
+  static thread_local lazyrow w;
+  if (w.size() != nrcols)
+    w.setsize(nrcols);
+
+  bool belongs = true;
+  matcoeff c, q;
+  c.init();
+  q.init();
+
+  w.load(currow);
+  currow.clear();
+
+  for (unsigned row = w.next(0); row < end && row < nrcols; row = w.next(row+1)) {
+    w.get(row, c);
+    if (c.z_p()) {
+      w.drop(row);
+      continue;
+    }
+
+    if (!rows[row].allocated()) { /* Insert v in rows at position row */
+      belongs = false;
+      q.inv(c);
+      rows[row] = w.extract(row, q);
+
+      if (Debug >= 3)
+	fprintf(LogFile, "# Adding row %d: " PRIsparsematvec "\n", row, &rows[row]);
+      break;
+    }
+
+    if (MarkowitzPivots && longer(rows[row], w.population())) {
+      /* currow causes less fill-in; make it the pivot, and go on
+	 with the old row */
+      q.inv(c);
+      sparsematvec pivot = w.extract(row, q);
+      w.load(rows[row]);
+      droprow(row);
+      rows[row] = pivot;
+      w.get(row, c);
+
+      if (Debug >= 3)
+	fprintf(LogFile, "# Swap row %d: " PRIsparsematvec "\n", row, &rows[row]);
+    }
+
+    neg(c, c);
+    w.addmul(c, rows[row]);
+    w.drop(row);
+  }
+
+  if (w.population()) { // left for the caller
+    c.set_si(1);
+    sparsematvec tail = w.extract(end, c);
+    currow.copy(tail);
+    tail.free();
+  }
+
+  q.clear();
+  c.clear();
+
+  if (!belongs)
+    Stats.keptrows++;
+
+  return belongs;
+}
+#else
+/* whether v has fewer entries than w */
+static bool shorter(const hollowmatvec &v, const sparsematvec &w) {
+  auto wi = w.begin();
+  for (auto kc __attribute__((unused)) : v) {
+    if (wi == w.end())
+      return false;
+    ++wi;
+  }
+  return wi != w.end();
+}
+
+/* whether v, with leading coefficient x, is a better pivot than w.
+   Set c = a*x, the canonical form of x, with a a unit. Without
+   MarkowitzPivots, never. Over p-adic rings, the lower valuation
+   wins, and ties are broken as over Z: v must have a unit leading
+   coefficient, and w not or be longer, so v causes less fill-in (the
+   Markowitz cost, for the same column) */
+static bool betterpivot(const hollowmatvec &v, const matcoeff &x, const sparsematvec &w, matcoeff &a, matcoeff &c) {
+  unit_annihilator(&a, nullptr, x);
+  mul(c, a, x);
+  if (!MarkowitzPivots)
+    return false;
+#if MATCOEFF_P > 0
+  matcoeff t;
+  t.init();
+  unsigned vv = t.val(c), vw = t.val(w[0].second);
+  t.clear();
+  if (vv != vw)
+    return vv < vw;
+#endif
+  return !c.cmp_si(1) && (w[0].second.cmp_si(1) || shorter(v, w));
+}
+
 // try to add currow to the row space spanned by rows.
 // return true if currow already belonged to the row space.
 // currow will be damaged (well, reduced) in the process.
-bool matrix::add1row(hollowmatvec currow) {
+// only columns before end are considered; the rest of currow is
+// left for the caller.
+bool matrix::add1row(hollowmatvec currow, unsigned end) {
   bool belongs = true;
 
   matcoeff a, b, c, d;
@@ -96,6 +395,9 @@ bool matrix::add1row(hollowmatvec currow) {
   for (const auto &kc : currow) {
     unsigned row = kc.first;
 
+    if (row >= end)
+      break;
+
     if (!rows[row].allocated()) { /* Insert v in rows at position row */
       belongs = false;
       unit_annihilator(&b, &a, kc.second);
@@ -103,9 +405,34 @@ bool matrix::add1row(hollowmatvec currow) {
       rows[row] = currow.getsparse();
       currow.clear();
       currow.addmul(a, rows[row]);
+#if MATCOEFF_P == 0
+      if (SizeReduce)
+	sizereduce(row);
+#endif
 
       if (Debug >= 3)
 	fprintf(LogFile, "# Adding row %d: " PRIsparsematvec "\n", row, &rows[row]);
+    } else if (betterpivot(currow, kc.second, rows[row], a, c)) {
+      /* make currow the pivot, and go on with the old row. Its
+	 leading coefficient is a multiple of c, so this replaces a
+	 merge by a shift */
+      if (cmp(c, rows[row][0].second))
+	belongs = false;
+      b.set(rows[row][0].second); // the old pivot's leading coefficient
+      currow.scale(a);
+      sparsematvec pivot = currow.getsparse();
+      currow.copy(rows[row]);
+      droprow(row);
+      rows[row] = pivot;
+      shdivexact(d, b, c);
+      currow.submul(d, rows[row]);
+#if MATCOEFF_P == 0
+      if (SizeReduce)
+	sizereduce(row);
+#endif
+
+      if (Debug >= 3)
+	fprintf(LogFile, "# Swap row %d: " PRIsparsematvec "\n", row, &rows[row]);
     } else { /* two rows with same pivot. Merge them */
       gcdext(d, a, b, kc.second, rows[row][0].second); /* d = a*v[head]+b*rows[row][head] */
       if (!cmp(d,rows[row][0].second)) { /* likely case: rows[row][head]=d. We're just reducing currow. */
@@ -129,7 +456,7 @@ bool matrix::add1row(hollowmatvec currow) {
 	neg(d, d);
 	currow.scale(d);
 	currow.addmul(c, rows[row]);
-	rows[row].free();
+	droprow(row);
 	rows[row] = vab.getsparse();
 	rowstack.release(vab);
 
@@ -141,6 +468,13 @@ bool matrix::add1row(hollowmatvec currow) {
 	unit_annihilator(&a, nullptr, rows[row].begin()->second);
 	if (cmp_si(a, 1))
 	  abortprintf(5, "add1row created a non-normalized row");
+#if MATCOEFF_P == 0
+	if (SizeReduce) { // both rows were scaled
+	  sizereduce(row);
+	  if (large(currow))
+	    sizereduce(currow, row);
+	}
+#endif
       }
     }
   }
@@ -150,9 +484,14 @@ bool matrix::add1row(hollowmatvec currow) {
   b.clear();
   a.clear();
 
+  if (!belongs)
+    Stats.keptrows++;
+
   return belongs;
 }
 
+#endif
+
 bool matrix::addrow(hollowpcvec currow) {
   if (currow.empty())
     return true;
@@ -168,20 +507,24 @@ bool matrix::addrow(hollowpcvec currow) {
   return status;
 }
 
-static std::vector<int> colamd(sparsematmat &m, unsigned nrcols) {
+/* order the rows m[which[i]], using only the columns j with
+   colmap[j] != -1U, renumbered to colmap[j] < nrcols. Return the
+   rows' indices in m */
+static std::vector<int> colamd(const sparsematmat &m, const std::vector<int> &which, const std::vector<unsigned> &colmap, unsigned nrcols) {
   std::vector<int> ind;
   int stats[COLAMD_STATS];
   std::vector<int> intmat;
 
-  for (const sparsematvec v : m) {
+  for (int i : which) {
     ind.push_back(intmat.size());
-    for (const auto &kc : v)
-      intmat.push_back(kc.first);
+    for (const auto &kc : m[i])
+      if (colmap[kc.first] != -1U)
+	intmat.push_back(colmap[kc.first]);
   }
   ind.push_back(intmat.size());
 
   if (Debug >= 2) {
-    fprintf(LogFile, "# about to collect %ld relations (%ld nnz)\n", m.size(), intmat.size());
+    fprintf(LogFile, "# about to collect %ld relations (%ld nnz)\n", which.size(), intmat.size());
     fprintf(LogFile, "# ind:");
     for (unsigned i = 0; i < ind.size(); i++) fprintf(LogFile, " %d", ind[i]);
     fprintf(LogFile, "\n# intmat:");
@@ -189,9 +532,9 @@ static std::vector<int> colamd(sparsematmat &m, unsigned nrcols) {
     fprintf(LogFile, "\n");
   }
 
-  size_t alloc = colamd_recommended(intmat.size(), nrcols, m.size());
+  size_t alloc = colamd_recommended(intmat.size(), nrcols, which.size());
   intmat.reserve(alloc);
-  int ok = colamd(nrcols, m.size(), alloc, intmat.data(), ind.data(), NULL, stats);
+  int ok = ::colamd(nrcols, which.size(), alloc, intmat.data(), ind.data(), NULL, stats);
   if (Debug >= 3) {
     // we capture the output of colamd_report, and pipe it to LogFile.
     // strangely enough, the documentation says that colamd_report writes to
@@ -226,7 +569,7 @@ static std::vector<int> colamd(sparsematmat &m, unsigned nrcols) {
     close(fds[1]);
 
     fprintf(LogFile, "# row permutation:");
-    for (unsigned i = 0; i < m.size(); i++)
+    for (unsigned i = 0; i < which.size(); i++)
       fprintf(LogFile, " %u", ind[i]);
     fprintf(LogFile,"\n");
   }
@@ -234,86 +577,1056 @@ static std::vector<int> colamd(sparsematmat &m, unsigned nrcols) {
   if (!ok)
     abortprintf(5, "colamd error %d", ok);
 
+  ind.resize(which.size());
+  for (int &i : ind)
+    i = which[i];
   return ind;
 }
 
-/* collect the vectors in queue and Matrix, and combine them back into Matrix */
+/* structured elimination, before ordering the new rows m. A row
+   whose leading coefficient is a unit, or sits alone in its column,
+   can become a pivot without any elimination if rows has none there:
+   choose the shortest such row for each column and put them first.
+   colamd orders the other rows, and only sees the columns that can
+   cause fill-in among them: columns with at least two entries, and
+   one of each set of identical columns. Return the order of all rows
+   of m. */
+static std::vector<int> presolve(const sparsematmat &m, const sparsematmat &rows, unsigned nrcols) {
+  std::vector<unsigned> colcount(nrcols, 0);
+  for (const sparsematvec v : m)
+    for (const auto &kc : v)
+      colcount[kc.first]++;
+
+  std::vector<int> pivot(nrcols, -1);
+  std::vector<size_t> pivotsize(nrcols);
+  matcoeff unit, annihilator, t;
+  unit.init();
+  annihilator.init();
+  t.init();
+  for (unsigned i = 0; i < m.size(); i++) {
+    if (m[i].empty() || rows[m[i][0].first].allocated())
+      continue;
+    const auto &lead = m[i][0];
+    unit_annihilator(&unit, &annihilator, lead.second);
+    if (annihilator.nz_p()) // the row would leave a multiple behind
+      continue;
+    mul(t, unit, lead.second);
+    if (colcount[lead.first] > 1 && t.cmp_si(1)) // not a unit
+      continue;
+    size_t size = m[i].size();
+    if (pivot[lead.first] == -1 || size < pivotsize[lead.first])
+      pivot[lead.first] = i, pivotsize[lead.first] = size;
+  }
+  t.clear();
+  annihilator.clear();
+  unit.clear();
+
+  std::vector<int> order, rest;
+  std::vector<bool> ispivot(m.size(), false);
+  for (int i : pivot)
+    if (i != -1) {
+      order.push_back(i);
+      ispivot[i] = true;
+    }
+  for (unsigned i = 0; i < m.size(); i++)
+    if (!ispivot[i])
+      rest.push_back(i);
+  if (rest.empty())
+    return order;
+
+  /* the columns of the remaining rows, as lists of rows */
+  std::vector<std::vector<int>> columns(nrcols);
+  for (unsigned r = 0; r < rest.size(); r++)
+    for (const auto &kc : m[rest[r]])
+      columns[kc.first].push_back(r);
+
+  std::vector<unsigned> colmap(nrcols, -1U);
+  std::unordered_multimap<uint64_t, unsigned> seen;
+  unsigned nrkept = 0;
+  for (unsigned j = 0; j < nrcols; j++) {
+    if (columns[j].size() < 2)
+      continue;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int r : columns[j])
+      hash = (hash ^ r) * 0x100000001b3ULL;
+    bool duplicate = false;
+    auto range = seen.equal_range(hash);
+    for (auto it = range.first; !duplicate && it != range.second; it++)
+      duplicate = (columns[it->second] == columns[j]);
+    if (duplicate)
+      continue;
+    seen.emplace(hash, j);
+    colmap[j] = nrkept++;
+  }
+
+  if (Debug >= 2)
+    fprintf(LogFile, "# presolve: %zu of %zu rows are pivots, colamd sees %u of %u columns\n", order.size(), m.size(), nrkept, nrcols);
+
+  std::vector<int> ind = colamd(m, rest, colmap, nrkept);
+  order.insert(order.end(), ind.begin(), ind.end());
+  return order;
+}
+
+#if MATCOEFF_P == 0 && MATCOEFF_K != 0
+/****************************************************************
+ * multi-modular Hermite normal form, used when the integer
+ * elimination overflows.
+ *
+ * the rows are first eliminated modulo a large prime, giving their
+ * rank r, r independent rows B and their pivot columns C. Let N be
+ * the other columns; the lattice L of rows satisfies x_N = x_C X
+ * with X = B_C^-1 B_N. The determinant d of B_C and the matrix dX
+ * are integral, and are computed modulo several primes and recovered
+ * by CRT, using Hadamard's bound.
+ *
+ * the projection of L to C contains d*Z^C, so its Hermite normal
+ * form can be computed with all entries reduced modulo d (Domich,
+ * Kannan and Trotter) and never grows beyond d. Its rows are lifted
+ * back to L using dX.
+ */
+#define MODPRIMES(X) X(4611686018427387847ULL) X(4611686018427387817ULL) X(4611686018427387787ULL) X(4611686018427387761ULL) \
+  X(4611686018427387751ULL) X(4611686018427387737ULL) X(4611686018427387733ULL) X(4611686018427387709ULL) \
+  X(4611686018427387701ULL) X(4611686018427387631ULL) X(4611686018427387617ULL) X(4611686018427387587ULL) \
+  X(4611686018427387461ULL) X(4611686018427387421ULL) X(4611686018427387409ULL) X(4611686018427387329ULL) \
+  X(4611686018427387323ULL) X(4611686018427387301ULL) X(4611686018427387271ULL) X(4611686018427387241ULL) \
+  X(4611686018427387139ULL) X(4611686018427387131ULL) X(4611686018427387127ULL) X(4611686018427387113ULL) \
+  X(4611686018427387091ULL) X(4611686018427387073ULL) X(4611686018427386981ULL) X(4611686018427386923ULL) \
+  X(4611686018427386911ULL) X(4611686018427386903ULL) X(4611686018427386897ULL) X(4611686018427386887ULL)
+const uint64_t RANKPRIME = 4611686018427387847ULL; // the first of MODPRIMES
+
+/* Gaussian elimination modulo P of the rows m[i], for i in order,
+   into pivots[j] with pivot 1 in column j. Return the pivot columns
+   in the order they were found, and the product of the pivots
+   before normalization in det. If source is non-null, append to it
+   the rows that produced pivots. */
+template<uint64_t P> static std::vector<unsigned> modelim(const sparsematmat &m, const std::vector<int> &order, std::vector<sparsevec<integer<P,1>>> &pivots, integer<P,1> &det, std::vector<int> *source) {
+  typedef integer<P,1> modcoeff;
+  std::vector<unsigned> found;
+  hollowvec<modcoeff> v;
+  v.alloc(pivots.size());
+  modcoeff q;
+  det.set_si(1);
+
+  for (int i : order) {
+    v.clear();
+    for (const auto &kc : m[i])
+      map(v[kc.first], kc.second);
+
+    for (const auto &kc : v) {
+      unsigned j = kc.first;
+      q.set(kc.second);
+      if (pivots[j].allocated())
+	v.submul(q, pivots[j]);
+      else {
+	det.mul(det, q);
+	q.inv(q);
+	v.scale(q);
+	pivots[j] = v.getsparse();
+	found.push_back(j);
+	if (source)
+	  source->push_back(i);
+	break;
+      }
+    }
+  }
+  v.free();
+
+  return found;
+}
+
+const size_t MODULARHNF_MAXBYTES = 1ULL << 30; // for dX, which is dense
+
+/* one step of the Chinese remainder theorem: det and dx = det*X are
+   known modulo modulus, make them known modulo modulus*P. Return
+   false, and change nothing, if B_C is singular modulo P. */
+template<uint64_t P> static bool crtstep(const sparsematmat &m, const std::vector<int> &basis, const std::vector<unsigned> &cols, const std::vector<unsigned> &nonpivots, unsigned nrcols, bigcoeff &det, std::vector<bigcoeff> &dx, bigcoeff &modulus) {
+  typedef integer<P,1> modcoeff;
+  std::vector<sparsevec<modcoeff>> pivots(nrcols, sparsevec<modcoeff>::null());
+  modcoeff d, q, t;
+  std::vector<unsigned> found = modelim<P>(m, basis, pivots, d, nullptr);
+
+  std::vector<unsigned> sorted(found);
+  std::sort(sorted.begin(), sorted.end());
+  bool ok = (sorted == cols);
+
+  if (ok) {
+    std::vector<unsigned> index(nrcols, -1u); // position of column in cols or nonpivots
+    for (unsigned i = 0; i < cols.size(); i++)
+      index[cols[i]] = i;
+    for (unsigned k = 0; k < nonpivots.size(); k++)
+      index[nonpivots[k]] = k;
+
+    // the sign of the permutation row -> pivot column
+    std::vector<bool> seen(found.size(), false);
+    for (unsigned i = 0; i < found.size(); i++) {
+      unsigned len = 0;
+      for (unsigned j = i; !seen[j]; j = index[found[j]], len++)
+	seen[j] = true;
+      if (len % 2 == 0 && len > 0)
+	d.neg(d);
+    }
+
+    // reduced echelon form, whose rows are (1 on C | X on N)
+    hollowvec<modcoeff> v;
+    v.alloc(nrcols);
+    for (auto j = cols.rbegin(); j != cols.rend(); j++) {
+      v.copy(pivots[*j]);
+      for (const auto &kc : v)
+	if (kc.first != *j && pivots[kc.first].allocated()) {
+	  q.set(kc.second);
+	  v.submul(q, pivots[kc.first]);
+	}
+      pivots[*j].free();
+      pivots[*j] = v.getsparse();
+    }
+    v.free();
+
+    std::vector<modcoeff> dxp(dx.size());
+    for (auto &c : dxp)
+      c.zero();
+    for (unsigned i = 0; i < cols.size(); i++)
+      for (const auto &kc : pivots[cols[i]])
+	if (kc.first != cols[i])
+	  dxp[i*nonpivots.size() + index[kc.first]].mul(d, kc.second);
+
+    // x += modulus * ((r - x) / modulus mod P)
+    map(t, modulus);
+    t.inv(t);
+    bigcoeff z;
+    z.init();
+    auto crt = [&](bigcoeff &x, const modcoeff &r) {
+      map(q, x);
+      q.sub(r, q);
+      q.mul(q, t);
+      map(z, q);
+      x.addmul(modulus, z);
+    };
+    crt(det, d);
+    for (unsigned i = 0; i < dx.size(); i++)
+      crt(dx[i], dxp[i]);
+    z.clear();
+    modulus.mul_si(modulus, P);
+  }
+
+  for (auto &p : pivots)
+    p.free();
+
+  return ok;
+}
+
+typedef bool crtstep_t(const sparsematmat &, const std::vector<int> &, const std::vector<unsigned> &, const std::vector<unsigned> &, unsigned, bigcoeff &, std::vector<bigcoeff> &, bigcoeff &);
+#define CRTSTEP(P) crtstep<P>,
+static crtstep_t *const CRTSTEPS[] = { MODPRIMES(CRTSTEP) };
+
+/* reduce all entries of v in [0,D) */
+static void reducemod(hollowvec<bigcoeff> &v, const bigcoeff &D) {
+  for (const auto &kc : v)
+    kc.second.fdiv_r(kc.second, D);
+}
+
+/* add v to the echelon form h, modulo D, as in add1row() */
+static void add1rowmod(std::vector<sparsevec<bigcoeff>> &h, hollowvec<bigcoeff> &v, hollowvec<bigcoeff> &w, const bigcoeff &D) {
+  bigcoeff a, b, c, d;
+  a.init();
+  b.init();
+  c.init();
+  d.init();
+
+  reducemod(v, D);
+  for (const auto &kc : v) {
+    unsigned j = kc.first;
+
+    if (!h[j].allocated()) { // the pivot is positive, since v is reduced
+      h[j] = v.getsparse();
+      break;
+    }
+    gcdext(d, a, b, kc.second, h[j][0].second);
+    c.divexact(kc.second, d);
+    if (!cmp(d, h[j][0].second))
+      v.submul(c, h[j]);
+    else {
+      d.divexact(h[j][0].second, d);
+      w.clear();
+      w.addmul(a, v);
+      w.addmul(b, h[j]);
+      reducemod(w, D);
+      d.neg(d);
+      v.scale(d);
+      v.addmul(c, h[j]);
+      h[j].free();
+      h[j] = w.getsparse();
+    }
+    reducemod(v, D);
+  }
+
+  d.clear();
+  c.clear();
+  b.clear();
+  a.clear();
+}
+
+/* try to put in rows the Hermite normal form of m. Return false,
+   and leave rows unchanged, if this method doesn't apply: it needs
+   too many primes or too much memory, or the result doesn't fit in
+   matcoeff */
+bool matrix::modularhnf(const sparsematmat &m, const std::vector<int> &ind) {
+  std::vector<int> order(ind.begin(), ind.begin() + m.size()), basis;
+  std::vector<unsigned> cols, nonpivots;
+  {
+    std::vector<sparsevec<integer<RANKPRIME,1>>> pivots(nrcols, sparsevec<integer<RANKPRIME,1>>::null());
+    integer<RANKPRIME,1> d;
+    cols = modelim<RANKPRIME>(m, order, pivots, d, &basis);
+    for (auto &p : pivots)
+      p.free();
+  }
+  std::sort(cols.begin(), cols.end());
+  for (unsigned j = 0, k = 0; j < nrcols; j++)
+    if (k < cols.size() && cols[k] == j)
+      k++;
+    else
+      nonpivots.push_back(j);
+  const unsigned r = cols.size(), n = nonpivots.size();
+
+  std::vector<unsigned> index(nrcols); // position of column in cols or nonpivots
+  for (unsigned i = 0; i < r; i++)
+    index[cols[i]] = i;
+  for (unsigned k = 0; k < n; k++)
+    index[nonpivots[k]] = k;
+
+  /* Hadamard's bound, in bits, on the minors of B */
+  size_t hadamard = 1;
+  bigcoeff z, t;
+  z.init();
+  t.init();
+  for (int i : basis) {
+    t.zero();
+    for (const auto &kc : m[i]) {
+      map(z, kc.second);
+      t.addmul(z, z);
+    }
+    hadamard += (t.sizeinbase(2) + 1) / 2;
+  }
+
+  /* dX has r*n entries of up to hadamard bits */
+  size_t maxbytes = MatrixMemory ? std::min(MatrixMemory, MODULARHNF_MAXBYTES) : MODULARHNF_MAXBYTES;
+  if ((double) r * n * (sizeof(bigcoeff) + hadamard / 8 + 8) > maxbytes) {
+    if (Debug >= 2)
+      fprintf(LogFile, "# modularhnf: rank %u of %u, determinant bound of %zu bits needs too much memory\n", r, nrcols, hadamard);
+    t.clear();
+    z.clear();
+    return false;
+  }
+
+  bigcoeff det, modulus;
+  det.init();
+  det.zero();
+  modulus.init();
+  modulus.set_si(1);
+  std::vector<bigcoeff> dx(r*n);
+  for (auto &c : dx) {
+    c.init();
+    c.zero();
+  }
+  unsigned nrprimes = 0;
+  for (crtstep_t *step : CRTSTEPS) {
+    if (modulus.sizeinbase(2) > hadamard + 1)
+      break;
+    nrprimes += step(m, basis, cols, nonpivots, nrcols, det, dx, modulus);
+  }
+  bool ok = modulus.sizeinbase(2) > hadamard + 1;
+
+  auto symmetric = [&](bigcoeff &x) { // remainder in (-modulus/2,modulus/2]
+    t.add(x, x);
+    if (t.cmp(modulus) > 0)
+      x.sub(x, modulus);
+  };
+  symmetric(det);
+  for (auto &c : dx)
+    symmetric(c);
+
+  if (Debug >= 2)
+    fprintf(LogFile, "# modularhnf: rank %u of %u, %u primes, determinant of %zu bits (bound %zu)\n", r, nrcols, nrprimes, det.sizeinbase(2), hadamard);
+
+  /* check that all rows satisfy det*x_N = x_C dX */
+  std::vector<bigcoeff> acc(n);
+  for (auto &c : acc)
+    c.init();
+  for (unsigned i = 0; ok && n > 0 && i < m.size(); i++) {
+    for (auto &c : acc)
+      c.zero();
+    for (const auto &kc : m[i]) {
+      map(z, kc.second);
+      if (std::binary_search(cols.begin(), cols.end(), kc.first))
+	for (unsigned k = 0; k < n; k++)
+	  acc[k].addmul(z, dx[index[kc.first]*n + k]);
+      else
+	acc[index[kc.first]].submul(z, det);
+    }
+    for (const auto &c : acc)
+      ok &= c.z_p();
+  }
+
+  std::vector<sparsevec<bigcoeff>> h(r, sparsevec<bigcoeff>::null()), full(r, sparsevec<bigcoeff>::null());
+  hollowvec<bigcoeff> v, w;
+  v.alloc(nrcols);
+  w.alloc(nrcols);
+
+  if (ok) {
+    bigcoeff D, g, a, b;
+    D.init();
+    g.init();
+    a.init();
+    b.init();
+    D.set(det);
+    if (D.sgn() < 0)
+      D.neg(D);
+
+    /* Hermite normal form of the projection to C, modulo D */
+    for (int i : order) {
+      v.clear();
+      for (const auto &kc : m[i])
+	if (std::binary_search(cols.begin(), cols.end(), kc.first))
+	  map(v[index[kc.first]], kc.second);
+      add1rowmod(h, v, w, D);
+    }
+
+    /* make sure D*e_j is in the row space */
+    for (unsigned j = 0; j < r; j++) {
+      if (!h[j].allocated()) {
+	h[j].alloc(1);
+	h[j][0].first = j;
+	h[j][0].second.set(D);
+	h[j].truncate(1);
+	continue;
+      }
+      gcdext(g, a, b, h[j][0].second, D);
+      if (!cmp(g, h[j][0].second))
+	continue;
+      v.copy(h[j]);
+      w.clear();
+      w.addmul(a, v);
+      reducemod(w, D);
+      w[j].set(g);
+      h[j].free();
+      h[j] = w.getsparse();
+      a.divexact(D, g);
+      v.scale(a);
+      v[j].zero();
+      add1rowmod(h, v, w, D);
+    }
+
+    /* reduce above the pivots, as in hermite(), and lift to L */
+    for (int j = r-1; ok && j >= 0; j--) {
+      v.copy(h[j]);
+      for (const auto &kc : v) {
+	unsigned k = kc.first;
+	if (k != (unsigned) j && !kc.second.reduced_p(h[k][0].second)) {
+	  a.fdiv_q(kc.second, h[k][0].second);
+	  v.submul(a, h[k]);
+	}
+      }
+      h[j].free();
+      h[j] = v.getsparse();
+
+      w.clear();
+      for (const auto &kc : h[j])
+	w[cols[kc.first]].set(kc.second);
+      for (unsigned k = 0; k < n; k++) {
+	t.zero();
+	for (const auto &kc : h[j])
+	  t.addmul(kc.second, dx[kc.first*n + k]);
+	fdiv_qr(a, b, t, det);
+	ok &= b.z_p();
+	w[nonpivots[k]].set(a);
+      }
+      full[j] = w.getsparse();
+      ok &= (full[j][0].first == cols[j]); // no entry left of the pivot
+    }
+
+    b.clear();
+    a.clear();
+    g.clear();
+    D.clear();
+  }
+
+  /* all entries must fit, before any row is written */
+  if (ok) {
+    matcoeff c;
+    c.init();
+    for (unsigned j = 0; ok && j < r; j++)
+      for (const auto &kc : full[j])
+	try {
+	  map(c, kc.second);
+	} catch (const coeff_overflow &) {
+	  ok = false;
+	  break;
+	}
+    c.clear();
+  }
+
+  if (ok)
+    for (unsigned j = 0; j < r; j++) {
+      rows[cols[j]].alloc(full[j].size());
+      auto ri = rows[cols[j]].begin();
+      for (const auto &kc : full[j]) {
+	ri->first = kc.first;
+	map(ri->second, kc.second);
+	ri++;
+      }
+      ri.markend();
+    }
+
+  for (auto &x : full)
+    x.free();
+  for (auto &x : h)
+    x.free();
+  w.free();
+  v.free();
+  for (auto &c : acc)
+    c.clear();
+  for (auto &c : dx)
+    c.clear();
+  modulus.clear();
+  det.clear();
+  t.clear();
+  z.clear();
+
+  return ok;
+}
+#endif
+
+/****************************************************************
+ * dense elimination.
+ *
+ * as the elimination proceeds, the rows with pivots in the last
+ * columns fill in, and following the links of hollow vectors costs
+ * more than the arithmetic. Once the trailing triangle is at least
+ * DENSE_FILL full, its rows are moved to a contiguous array; the
+ * incoming rows are reduced sparsely up to it, and then densely, a
+ * block of DENSE_BLOCK rows at a time, column by column, so that
+ * each pivot row is read once per block. The result is the same as
+ * with add1row().
+ */
+const double DENSE_FILL = 0.5;
+const unsigned DENSE_MINCOLS = 64, DENSE_BLOCK = 32;
+
+/* the first column of the largest trailing triangle that is dense
+   enough, or nrcols if there is none */
+static unsigned densestart(const sparsematmat &rows, unsigned nrcols) {
+  unsigned start = nrcols;
+  uint64_t nnz = 0;
+  for (unsigned j = nrcols; j-- > 0;) {
+    if (rows[j].allocated())
+      nnz += rows[j].size();
+    uint64_t n = nrcols - j;
+    if (n >= DENSE_MINCOLS && nnz >= DENSE_FILL * n*(n+1)/2)
+      start = j;
+  }
+  return start;
+}
+
+class densematrix {
+  const unsigned start, n; // columns [start,start+n)
+  std::vector<matcoeff> pivots; // row j, at j*n, has its pivot in column start+j
+  std::vector<bool> haspivot;
+  std::vector<matcoeff> block; // incoming rows, at b*n
+  std::vector<bool> belongs; // whether incoming row b belongs to the row space so far
+  unsigned nrblock;
+  matcoeff a, b, c, d, t;
+
+  void keep(unsigned r) {
+    if (belongs[r])
+      Stats.keptrows++;
+    belongs[r] = false;
+  }
+
+public:
+  densematrix(const sparsematmat &rows, unsigned _start, unsigned nrcols) : start(_start), n(nrcols - _start), pivots(n*n), haspivot(n, false), block(DENSE_BLOCK*n), belongs(DENSE_BLOCK), nrblock(0) {
+    for (auto &x : pivots)
+      x.init(), x.zero();
+    for (auto &x : block)
+      x.init(), x.zero();
+    a.init();
+    b.init();
+    c.init();
+    d.init();
+    t.init();
+
+    for (unsigned j = 0; j < n; j++)
+      if (rows[start+j].allocated()) {
+	for (const auto &kc : rows[start+j])
+	  pivots[j*n + kc.first-start].set(kc.second);
+	haspivot[j] = true;
+      }
+  }
+
+  ~densematrix() {
+    t.clear();
+    d.clear();
+    c.clear();
+    b.clear();
+    a.clear();
+    for (auto &x : block)
+      x.clear();
+    for (auto &x : pivots)
+      x.clear();
+  }
+
+  /* queue the entries of v from column start on. Its other entries
+     have been eliminated by add1row(), which returned belongs */
+  void push(const hollowmatvec &v, bool belongs) {
+    matcoeff *w = &block[nrblock*n];
+    for (const auto &kc : v)
+      if (kc.first >= start)
+	w[kc.first-start].set(kc.second);
+    this->belongs[nrblock++] = belongs;
+    if (nrblock == DENSE_BLOCK)
+      flush();
+  }
+
+  /* eliminate the queued rows, as add1row() would */
+  void flush() {
+    for (unsigned j = 0; j < n; j++) {
+      matcoeff *p = &pivots[j*n];
+      for (unsigned r = 0; r < nrblock; r++) {
+	matcoeff *v = &block[r*n];
+	if (v[j].z_p())
+	  continue;
+
+	if (!haspivot[j]) {
+	  keep(r);
+	  unit_annihilator(&b, &a, v[j]);
+	  for (unsigned k = j; k < n; k++) {
+	    mul(p[k], v[k], b);
+	    mul(v[k], a, p[k]);
+	  }
+	  haspivot[j] = true;
+	} else {
+	  gcdext(d, a, b, v[j], p[j]);
+	  if (!cmp(d, p[j])) {
+	    shdivexact(d, v[j], d);
+	    for (unsigned k = j; k < n; k++)
+	      submul(v[k], d, p[k]);
+	  } else {
+	    keep(r);
+	    shdivexact(c, v[j], d);
+	    shdivexact(d, p[j], d);
+	    neg(d, d);
+	    for (unsigned k = j; k < n; k++) { // (v, p) <- (-d*v + c*p, a*v + b*p)
+	      mul(t, a, v[k]);
+	      addmul(t, b, p[k]);
+	      mul(v[k], d, v[k]);
+	      addmul(v[k], c, p[k]);
+	      p[k].set(t);
+	    }
+	  }
+	}
+      }
+    }
+    nrblock = 0;
+  }
+
+  /* put the pivot rows back into rows */
+  void unload(sparsematmat &rows) {
+    flush();
+    for (unsigned j = 0; j < n; j++) {
+      if (!haspivot[j])
+	continue;
+      const matcoeff *p = &pivots[j*n];
+      unsigned size = 0;
+      for (unsigned k = j; k < n; k++)
+	size += p[k].nz_p();
+      rows[start+j].alloc(size);
+      auto ri = rows[start+j].begin();
+      for (unsigned k = j; k < n; k++)
+	if (p[k].nz_p()) {
+	  ri->first = start+k;
+	  ri->second.set(p[k]);
+	  ri++;
+	}
+      ri.markend();
+    }
+  }
+};
+
+/* add the rows m[ind[i]] into rows, in that order. If consume, free
+   them along the way. Switch to dense elimination when the rows
+   fill in. */
+void matrix::addrows(sparsematmat &m, const std::vector<int> &ind, bool consume) {
+  densematrix *dense = nullptr;
+  unsigned start = nrcols;
+  const unsigned checkevery = std::max<unsigned>(DENSE_BLOCK, ind.size() / 32);
+
+  try {
+    for (unsigned i = 0; i < ind.size(); i++) {
+      if (dense == nullptr && i % checkevery == 0 && i > 0) {
+	start = densestart(rows, nrcols);
+	if (start < nrcols) {
+	  if (Debug >= 2)
+	    fprintf(LogFile, "# addrows: dense elimination of columns %u..%u, from row %u of %zu\n", start, nrcols-1, i, ind.size());
+	  dense = new densematrix(rows, start, nrcols);
+	  for (unsigned j = start; j < nrcols; j++)
+	    if (rows[j].allocated())
+	      droprow(j);
+	}
+      }
+
+      hollowmatvec currow = rowstack.fresh();
+      currow.copy(m[ind[i]]);
+      if (consume)
+	m[ind[i]].free();
+      if (dense == nullptr)
+	add1row(currow);
+      else
+	dense->push(currow, add1row(currow, start));
+      rowstack.release(currow);
+    }
+    if (dense != nullptr) {
+      dense->unload(rows);
+      delete dense;
+    }
+  } catch (...) {
+    delete dense;
+    throw;
+  }
+}
+
+/****************************************************************
+ * spilling the queue to disk.
+ *
+ * with --matrix-mem, the queued rows that don't fit in memory are
+ * written to a temporary file, in --spill-dir if given: the number
+ * of entries, then each column as a difference from the previous one
+ * and each coefficient as an integer (see spill.hh), so that small
+ * entries take a byte each. The queue is flushed once the file
+ * reaches SPILL_FACTOR times the memory budget; flushqueue() reads
+ * it back a memory's worth at a time.
+ */
+static const unsigned SPILLED = 1U << 31; // in fingerprints, a row in spillfile
+const unsigned SPILL_FACTOR = 16;
+
+static FILE *openspill() {
+  if (SpillDirectory == nullptr)
+    return tmpfile();
+  std::string name = std::string(SpillDirectory) + "/anq-spill-XXXXXX";
+  int fd = mkstemp(&name[0]);
+  if (fd < 0)
+    return nullptr;
+  unlink(name.c_str()); // removed when closed
+  FILE *f = fdopen(fd, "w+");
+  if (f == nullptr)
+    close(fd);
+  return f;
+}
+
+void matrix::spillrow(const sparsematvec &v) {
+  if (spillfile == nullptr) {
+    spillfile = openspill();
+    if (spillfile == nullptr)
+      abortprintf(1, "I can't create a spill file in '%s': %s", SpillDirectory ? SpillDirectory : P_tmpdir, strerror(errno));
+    spilled.assign(1, 0);
+  }
+
+  std::string s;
+  bigcoeff z;
+  z.init();
+  putvarint(s, v.size());
+  unsigned prev = 0;
+  for (const auto &kc : v) {
+    putvarint(s, kc.first - prev);
+    prev = kc.first;
+    map(z, kc.second);
+    putinteger(s, z);
+  }
+  z.clear();
+
+  if (fwrite(s.data(), 1, s.size(), spillfile) != s.size())
+    abortprintf(1, "I can't write to spill file: %s", strerror(errno));
+  spilled.push_back(spilled.back() + s.size());
+}
+
+void matrix::closespill() {
+  if (spillfile != nullptr)
+    fclose(spillfile);
+  spillfile = nullptr;
+  spilled.clear();
+}
+
+/* the i-th row in spillfile, in a fresh vector */
+sparsematvec matrix::unspillrow(size_t i) const {
+  std::string s(spilled[i+1] - spilled[i], 0);
+  if (fflush(spillfile) != 0 || pread(fileno(spillfile), &s[0], s.size(), spilled[i]) != (ssize_t) s.size())
+    abortprintf(1, "I can't read from spill file: %s", strerror(errno));
+
+  const unsigned char *p = (const unsigned char *) s.data();
+  unsigned len = getvarint(p), prev = 0;
+  sparsematvec v;
+  v.alloc(len);
+  bigcoeff z;
+  z.init();
+  for (unsigned k = 0; k < len; k++) {
+    prev += getvarint(p);
+    v[k].first = prev;
+    getinteger(p, z);
+    map(v[k].second, z);
+  }
+  v.truncate(len);
+  z.clear();
+  return v;
+}
+
+/* whether v is the queued row at position, as recorded in fingerprints */
+bool matrix::isqueued(unsigned position, const sparsematvec &v) const {
+  if (!(position & SPILLED))
+    return queue[position] == v;
+  sparsematvec w = unspillrow(position & ~SPILLED);
+  bool equal = (w == v);
+  w.free();
+  return equal;
+}
+
+/* reduce the rows newrels against Matrix, add them to it, and free
+   them. The rows of Matrix are kept as they are: only newrels is
+   ordered and eliminated. */
+void matrix::flushrows(sparsematmat &newrels) {
+  for (const sparsematvec v : newrels)
+    Stats.nnzbefore += v.size();
+
+  /* determine a good insertion ordering */
+  std::vector<int> ind = presolve(newrels, rows, nrcols);
+
+  /* add rows of newrels into rows, reducing them along the way, and in
+     the order specified by the permutation ind */
+#if MATCOEFF_P == 0 && MATCOEFF_K != 0
+  saved = rows; // not freed by droprow(), in case we start again
+  std::string overflow;
+  try {
+    addrows(newrels, ind, false);
+    for (unsigned j = 0; j < nrcols; j++)
+      if (!saved[j].is_identical(rows[j]))
+	saved[j].free();
+  } catch (const coeff_overflow &e) { // start again, with bounded coefficients
+    overflow = e.what();
+    rowstack.reset();
+    for (unsigned j = 0; j < nrcols; j++)
+      if (!rows[j].is_identical(saved[j]))
+	rows[j].free();
+
+    sparsematmat all;
+    std::vector<int> order;
+    for (const sparsematvec v : saved)
+      if (v.allocated()) {
+	order.push_back(all.size());
+	all.push_back(v);
+      }
+    for (int i : ind)
+      order.push_back(all.size() + i);
+    all.insert(all.end(), newrels.begin(), newrels.end());
+
+    rows.assign(nrcols, sparsematvec::null());
+    if (modularhnf(all, order)) {
+      overflow.clear();
+      for (sparsematvec v : saved)
+	v.free();
+    } else
+      rows = saved;
+  }
+  saved.clear();
+  for (sparsematvec v : newrels)
+    v.free();
+  newrels.clear();
+  if (!overflow.empty())
+    throw coeff_overflow(overflow);
+#else
+  addrows(newrels, ind, true);
+  newrels.clear();
+#endif
+}
+
+/* add the queued rows to Matrix: those in memory, and then those in
+   spillfile, a memory's worth at a time */
 void matrix::flushqueue() {
-  if (queue.empty())
+  if (queue.empty() && spilled.empty())
     return;
 
-  /* remove unbound entries in rows */
-  rows.erase(std::remove(rows.begin(), rows.end(), sparsematvec::null()), rows.end());
+  for (const sparsematvec v : rows)
+    if (v.allocated())
+      Stats.nnzbefore += v.size();
 
-  /* put queue at bottom of matrix */
-  rows.insert(rows.end(), queue.begin(), queue.end());
-  queue.clear();
+  sparsematmat newrels;
+  newrels.swap(queue);
+  queuebytes = 0;
+  fingerprints.clear();
 
-  /* call colamd to determine optimal insertion ordering */
-  std::vector<int> ind = colamd(rows, nrcols);
+  try {
+    flushrows(newrels);
 
-  sparsematmat oldrels(nrcols, sparsematvec::null());
-  rows.swap(oldrels);
+    if (!spilled.empty() && Debug >= 2)
+      fprintf(LogFile, "# flushqueue: reading back %zu rows (%" PRIu64 " bytes) from disk\n", spilled.size()-1, spilled.back());
+    for (size_t i = 0; i+1 < spilled.size();) {
+      size_t bytes = 0;
+      while (i+1 < spilled.size() && (bytes < MatrixMemory || newrels.empty())) {
+	newrels.push_back(unspillrow(i++));
+	bytes += (newrels.back().size()+1) * sizeof(sparsematvec::slot);
+      }
+      flushrows(newrels);
+    }
+  } catch (const coeff_overflow &) { // the rest of the queue is abandoned
+    closespill();
+    throw;
+  }
+  closespill();
 
-  /* add rows of oldrels into rows, reducing them along the way, and in
-     the order specified by the permutation ind */
-  for (unsigned i = 0; i < oldrels.size(); i++) {
+  for (const sparsematvec v : rows)
+    if (v.allocated())
+      Stats.nnzafter += v.size();
+
+  TimeStamp("matrix::flushqueue()");
+}
+
+/* whether every column has a unit pivot: then the rows span
+   everything, and no further row can change them. A unit pivot is
+   never replaced by a worse one, so the columns are scanned once */
+bool matrix::full() {
+  while (fullcols < nrcols && rows[fullcols].allocated() && !rows[fullcols][0].second.cmp_si(1))
+    fullcols++;
+  return fullcols == nrcols;
+}
+
+#if MATCOEFF_P > 0 && MATCOEFF_K > 1
+/* complete the echelon form into a Howell form: for a pivot P^v, the
+   row times P^(K-v) has a vanishing leading coefficient, and must be
+   spanned by the rows below. add1row() adds it when it inserts a row,
+   but not when it makes a row of lower valuation the pivot; so add
+   them all, from left to right */
+void matrix::howell() {
+  matcoeff a;
+  a.init();
+  for (unsigned j = 0; j < nrcols; j++) {
+    if (!rows[j].allocated() || !rows[j][0].second.cmp_si(1))
+      continue;
+    unit_annihilator(nullptr, &a, rows[j][0].second);
     hollowmatvec currow = rowstack.fresh();
-    currow.copy(oldrels[ind[i]]);
-    oldrels[ind[i]].free();
+    currow.addmul(a, rows[j]);
     add1row(currow);
     rowstack.release(currow);
   }
-  TimeStamp("matrix::flushqueue()");
+  a.clear();
+
+  TimeStamp("matrix::howell()");
 }
+#endif
 
 // @@@ find tricks to avoid arithmetic overflow
 
 // complete the Hermite normal form
-void matrix::hermite() {
-  /* reduce all the head columns, to achieve Hermite normal form. */
+static const unsigned HERMITE_BLOCK = 64; // rows per thread in a block of hermite()
+
+/* reduce row j by the rows of pivot >= from, using stack. If last,
+   this is the last pass on row j, and if torsionfree it's made
+   primitive */
+void matrix::hermiterow(unsigned j, unsigned from, vec_supply<hollowmatvec> &stack, bool last) {
+  if (!rows[j].allocated())
+    return;
+
+#ifdef LAZYFIELD
+  static thread_local lazyrow w;
+  if (w.size() != nrcols)
+    w.setsize(nrcols);
+
+  matcoeff c;
+  c.init();
+  w.load(rows[j]);
+  rows[j].free();
+
+  for (unsigned k = w.next(std::max(j+1, from)); k < nrcols; k = w.next(k+1))
+    if (rows[k].allocated()) {
+      w.get(k, c);
+      neg(c, c);
+      w.addmul(c, rows[k]);
+      w.drop(k);
+    }
+
+  c.set_si(1);
+  rows[j] = w.extract(j, c);
+  c.clear();
+#else
   matcoeff q;
   q.init();
-  for (int j = nrcols-1; j >= 0; j--) {
-    if (!rows[j].allocated())
+  hollowmatvec currow = stack.fresh();
+  currow.copy(rows[j]);
+  rows[j].free();
+
+  for (const auto &kc : currow) {
+    unsigned row = kc.first;
+    if (row < from || !rows[row].allocated())
       continue;
 
-    hollowmatvec currow = rowstack.fresh();
-    currow.copy(rows[j]);
-    rows[j].free();
+    if (!reduced_p(kc.second, rows[row][0].second)) {
+      shdiv_q(q, kc.second, rows[row][0].second);
+      currow.submul(q, rows[row]);
+    }
+  }
 
+  if (last && torsionfree) { // furthermore, divide by gcd of row entries
+    matcoeff gcd, a, b;
+    gcd.init();
+    a.init();
+    b.init();
+    gcd.set_si(0);
     for (const auto &kc : currow) {
-      unsigned row = kc.first;
-      if (row == (unsigned) j || !rows[row].allocated())
-	continue;
-
-      if (!reduced_p(kc.second, rows[row][0].second)) {
-	shdiv_q(q, kc.second, rows[row][0].second);
-	currow.submul(q, rows[row]);
-      }
+      gcdext(gcd, a, b, kc.second, gcd);
+      if (!gcd.cmp_si(1))
+	goto stop;
     }
+    for (const auto &kc : currow)
+      shdivexact(kc.second, kc.second, gcd);
+  stop:
+    b.clear();
+    a.clear();
+    gcd.clear();
+  }
 
-    if (torsionfree) { // furthermore, divide by gcd of row entries
-      matcoeff gcd, a, b;
-      gcd.init();
-      a.init();
-      b.init();
-      gcd.set_si(0);
-      for (const auto &kc : currow) {
-	gcdext(gcd, a, b, kc.second, gcd);
-	if (!gcd.cmp_si(1))
-	  goto stop;
-      }
-      for (const auto &kc : currow)
-	shdivexact(kc.second, kc.second, gcd);
-    stop:
-      b.clear();
-      a.clear();
-      gcd.clear();
-    }
+  rows[j] = currow.getsparse();
+  stack.release(currow);
+  q.clear();
+#endif
+}
 
-    rows[j] = currow.getsparse();
-    rowstack.release(currow);
+void matrix::hermite() {
+#if MATCOEFF_P > 0 && MATCOEFF_K > 1
+  howell();
+#endif
+
+  /* reduce all the head columns, to achieve Hermite normal form. */
+  if (NrThreads <= 1)
+    for (int j = nrcols-1; j >= 0; j--)
+      hermiterow(j, j+1, rowstack, true);
+  else {
+    /* by blocks of columns, from the right. Once the rows right of a
+       block are final, its rows are reduced by them concurrently;
+       then they're finished one after the other, which only changes
+       entries in the block, and a few to its right. */
+    static thread_local vec_supply<hollowmatvec> hermitestack;
+    unsigned hi = nrcols;
+    while (hi > 0) {
+      std::vector<unsigned> block;
+      unsigned lo = hi;
+      while (lo > 0 && block.size() < HERMITE_BLOCK * NrThreads)
+	if (rows[--lo].allocated())
+	  block.push_back(lo);
+
+      if (hi < nrcols)
+	parallel_for(NrThreads, block.size(), [this]() {
+	    if (hermitestack.getsize() != nrcols)
+	      hermitestack.setsize(nrcols);
+	  }, [this, &block, hi](size_t i) {
+	    hermiterow(block[i], hi, hermitestack, false);
+	  });
+      for (unsigned j : block) // in decreasing order
+	hermiterow(j, j+1, rowstack, true);
+      hi = lo;
+    }
   }
 
   /* @@@ We could improve this code by eliminating redundant
@@ -322,8 +1635,6 @@ void matrix::hermite() {
    second columns. This requires a different format, and is perhaps
    best done outside this matrix code. */
 
-  q.clear();
-
   TimeStamp("matrix::hermite()");
 }
 
@@ -355,13 +1666,22 @@ sparsepcvec matrix::getrel(pccoeff &c, gen g) const {
 }
 
 /* tries to add a row to the queue; returns true if the row was added.
- empty the queue if it got full. */
+ empty the queue if it got full.
+
+ the row is scaled by the unit that normalizes its leading
+ coefficient, so rows that differ by a unit are recognized as
+ duplicates. They are recognized by a 64-bit fingerprint, and only
+ compared entry by entry when fingerprints agree. */
 void matrix::queuerow(const hollowpcvec hv) {
   if (hv.empty()) // easy case: trivial relation, change nothing
     return;
 
   sparsematvec cv;
+  uint64_t fingerprint = 0;
   {
+    matcoeff unit;
+    unit.init();
+    bool first = true;
     cv.alloc(hv.size());
     auto i = cv.begin();
     for (const auto &kc : hv) {
@@ -369,20 +1689,45 @@ void matrix::queuerow(const hollowpcvec hv) {
       if (kc.first < shift) // sanity check
 	abortprintf(5, "matrix::queuerow: vector has a term a%d of too low index", cv[0].first);
       i->first = kc.first-shift;
+      if (first) {
+	unit_annihilator(&unit, nullptr, i->second);
+	first = false;
+      }
+      if (unit.cmp_si(1))
+	mul(i->second, i->second, unit);
+      fingerprint ^= i->first + 0x9e3779b97f4a7c15ULL + (fingerprint << 6) + (fingerprint >> 2);
+      fingerprint ^= matcoeff::hash()(i->second) * 0xff51afd7ed558ccdULL + (fingerprint << 6) + (fingerprint >> 2);
       i++;
     }
     i.markend();
+    unit.clear();
   }
 
-  auto p = queue.insert(cv);
-  if (!p.second) { // we were already there, insert failed
+  Stats.queued++;
+  size_t bytes = (hv.size()+1) * sizeof(sparsematvec::slot);
+  bool spill = MatrixMemory != 0 && queuebytes + bytes > MatrixMemory;
+  auto p = fingerprints.emplace(fingerprint, spill ? SPILLED | (spilled.empty() ? 0 : spilled.size()-1) : queue.size());
+  if (!p.second && isqueued(p.first->second, cv)) { // we were already there
+    Stats.duplicates++;
     cv.free();
     return;
   }
+  // on a fingerprint collision, keep the row anyway; the one queued first keeps the fingerprint
+  if (spill) {
+    spillrow(cv);
+    cv.free();
+  } else {
+    queue.push_back(cv);
+    queuebytes += bytes;
+  }
 
   /* @@@ optimize for the factor "10". If too small, we'll cause
      fill-in in the matrix. If too large, we'll use too much
-     memory. */
-  if (queue.size() >= 10*nrcols)
+     memory. With a memory budget, the rows beyond it are on disk,
+     and the disk is bounded by SPILL_FACTOR budgets. */
+  size_t nrqueued = queue.size() + (spilled.empty() ? 0 : spilled.size()-1);
+  if (nrqueued >= 10*nrcols || (!spilled.empty() && spilled.back() >= SPILL_FACTOR * (uint64_t) MatrixMemory))
     flushqueue();
 }
+
+END_NQ
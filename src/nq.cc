@@ -7,31 +7,28 @@
 
 #include "nq.h"
 #include <string.h>
+#include <ctype.h>
+#include <memory>
+#include <getopt.h>
 #include <sys/types.h>
 #include <unistd.h>
 #ifdef MEMCHECK
 #include <mcheck.h>
 #endif
 
-FILE *OutputFile = stdout, *LogFile = stdout;
-unsigned Debug = 0;
+#ifdef NQ_WIDER
+/* the copy of nq, with arbitrary-precision integers, that computes
+ * the classes in which coefficients overflow */
+namespace NQ_WIDER {
+  int widen(int, char **, const std::string &, const std::string &, std::string *);
+}
+#endif
 
-clock_t ClockStart;
+BEGIN_NQ
 
-void abortprintf(int errorcode, const char *format, ...) {
-  va_list ap;
-  va_start(ap, format);
-  
-  vfprintf(stderr, format, ap);
-  fprintf(stderr,"\n");
+FILE *OutputFile = stdout;
 
-  if (LogFile != stdout)
-    vfprintf(LogFile, format, ap), fprintf(LogFile,"\n");
-
-  va_end(ap);
-  
-  exit(errorcode);
-}
+static const unsigned MAXTHREADS = 1024; // accepted by -t
 
 // for debugging, lldb is lost when printing these objects
 void PRINT(hollowpcvec &v) {
@@ -46,17 +43,6 @@ void PRINT(pccoeff &c) {
   printf(PRIpccoeff "\n", &c);
 }
 
-void TimeStamp(const char *s) {
-  static clock_t lastclock = 0;
-
-  if (Debug) {
-    clock_t newclock = clock();
-    fprintf(LogFile, "# %s finished, %.3gs\n", s, (newclock-lastclock) / (float)CLOCKS_PER_SEC);
-    fflush(LogFile);
-    lastclock = newclock;
-  }
-}
-
 const char USAGE[] = "Usage: nq <options> [<inputfile>] [<maximal weight>]\n"
   "(with no input file, presentation is read from STDIN)\n"
   "\t[-A]\tprint GAP output, default false (load then object with `ReadAsFunction(filename)()`"
@@ -64,6 +50,7 @@ const char USAGE[] = "Usage: nq <options> [<inputfile>] [<maximal weight>]\n"
   ". once=PcpGroup, twice=PcGroup"
 #endif
   "\n"
+  "\t[-B <binaryfile>]\talso write presentation in binary form, see anqread.h\n"
   "\t[-C]\ttoggle printing compact form of multiplication table, default true\n"
   "\t[-D]\tincrease debug level\n"
   "\t[-F <outputfile>]\n"
@@ -76,13 +63,23 @@ const char USAGE[] = "Usage: nq <options> [<inputfile>] [<maximal weight>]\n"
 #if defined(GROUP) && PCCOEFF_P > 0
   "\t[-J]\tcompute quotient by Jennings series, default false\n"
 #endif
+  "\t[-K <checkpoint>]\tsave presentation after each class\n"
   "\t[-L <logfile>]\n"
   "\t[-M]\tcompute metabelian " LIEGPSTRING ", default false\n"
+  "\t[--matrix-mem <bytes>]\tkeep at most that much of the queued relations in memory, spill the rest to disk, and eliminate them once the disk holds 16 times as much; suffixes k, M, G are allowed\n"
+  "\t[--spill-dir <directory>]\twhere --matrix-mem spills, default the system's temporary directory\n"
+  "\t[--no-markowitz]\tin the matrix, keep the first pivot found in each column, rather than the one of lowest valuation or the shortest one with unit coefficient\n"
   "\t[-N <nilpotency class>]\n"
 #if PCCOEFF_P == 0
     "\t[-T]\tforce successive quotients to be torsion-free, default false\n"
+#endif
+#if MATCOEFF_P == 0
+  "\t[--size-reduce]\tkeep the relation matrix's rows short while eliminating, by pairwise reduction against the later pivot rows; makes coefficient overflow rarer\n"
 #endif
   "\t[-P]\ttoggle printing definitions of basic commutators, default false\n"
+  "\t[-S <statsfile>]\twrite resource usage per phase, as JSON lines\n"
+  "\t[-R <checkpoint>]\tresume from checkpoint, and keep saving to it unless -K is given\n"
+  "\t[-t <threads>]\tnumber of worker threads, default 1\n"
   "\t[-W <maximal weight>] (can also appear as last argument)\n"
   "\t[-Z]\ttoggle printing zeros in multiplication table, default true";
 
@@ -96,46 +93,6 @@ const char EXTENDEDUSAGE[] = "Presentation format:\n"
   "\tterm = '-' expr | '~' expr | '(' expr ')' | '[' exprlist ']' | '{' exprlist '}' | number | gen (with usual precedence)\n"
   "\tnumber = [0-9]+ (if starting with 0 then in given base, otherwise base 10)\n";
 
-#ifndef NO_TRIO
-template <typename T> static int coeff_print(void *ref)
-{
-  T *data = (T *) trio_get_argument(ref);
-  if (data == nullptr)
-    return -1;
-  char *buffer = (char *) get_str(nullptr, 0, 10, *data);
-  trio_print_string(ref, buffer);
-  int len = strlen(buffer);
-  free(buffer);
-  return len;
-}  
-
-template <typename V> static int cvec_print(void *ref)
-{
-  V *data = (V *) trio_get_argument(ref);
-  if (data == nullptr)
-    return -1;
-
-  bool first = true;
-  for (const auto &kc : *data) {
-    char *buffer = (char *) get_str(nullptr, 0, 10, kc.second);
-#ifdef GROUP
-    if (first) first = false; else trio_print_string(ref, " * ");
-    trio_print_string(ref, "a");
-    trio_print_int(ref, kc.first);
-    trio_print_string(ref, "^");
-    trio_print_string(ref, buffer);
-#else
-    if (first) first = false; else trio_print_string(ref, " + ");
-    trio_print_string(ref, buffer);
-    trio_print_string(ref, "*a");
-    trio_print_int(ref, kc.first);
-#endif
-    free(buffer);
-  }
-  return 0;
-}  
-#endif
-
 char *utoa(char *s, unsigned len, unsigned n) {
   if (n == -1u)
     strcpy(s, "∞");
@@ -144,6 +101,61 @@ char *utoa(char *s, unsigned len, unsigned n) {
   return s;
 }
 
+/* set by widen(): the presentation, and a checkpoint of the pc
+ * presentation from which to continue. If WidenResult is set, only
+ * one class is computed, and its checkpoint is returned there */
+static const std::string *WidenInput = nullptr, *WidenCheckpoint = nullptr;
+static std::string *WidenResult = nullptr;
+
+#ifdef NQ_WIDER
+/* the contents of filename, or stdin if nullptr */
+static std::string readinput(const char *filename) {
+  FILE *f = filename ? fopen(filename, "r") : stdin;
+  if (f == NULL)
+    abortprintf(1, "Can't open input file '%s'", filename);
+
+  std::string s;
+  char buffer[4096];
+  size_t len;
+  while ((len = fread(buffer, 1, sizeof buffer, f)) > 0)
+    s.append(buffer, len);
+  if (f != stdin)
+    fclose(f);
+  return s;
+}
+#endif
+
+static std::string checkpoint(const pcpresentation &pc) {
+  char *buffer;
+  size_t len;
+  FILE *f = open_memstream(&buffer, &len);
+  if (f == nullptr)
+    abortprintf(1, "checkpoint: open_memstream() failed");
+  pc.savecheckpoint(f);
+  fclose(f);
+
+  std::string s(buffer, len);
+  free(buffer);
+  return s;
+}
+
+/* load a checkpoint made by checkpoint(), maybe in another copy of
+ * nq. Return false if its coefficients don't fit, and then pc should
+ * be discarded */
+static bool loadcheckpoint(pcpresentation &pc, const std::string &s) {
+  FILE *f = fmemopen((void *) s.data(), s.size(), "r");
+  if (f == nullptr)
+    abortprintf(1, "fmemopen() failed");
+  bool ok = true;
+  try {
+    pc.loadcheckpoint(f, "<overflow>");
+  } catch (const coeff_overflow &) {
+    ok = false;
+  }
+  fclose(f);
+  return ok;
+}
+
 int main(int argc, char **argv) {
   int c;
   bool PrintZeros = true, PrintCompact = true, PrintDefs = false;
@@ -156,21 +168,36 @@ int main(int argc, char **argv) {
   const bool Jacobson = false;
 #endif
   unsigned MaxWeight = -1u, NilpotencyClass = -1u;
-  const char *InputFileName;
-
-  // install handler
-#ifndef NO_TRIO
-  auto handle_pccoeff = trio_register(coeff_print<pccoeff>, "c%p"); // coeffs can be printed as PRIpccoeff
-  auto handle_sparsepcvec = trio_register(cvec_print<sparsepcvec>, "s%p"); // sparsepcvecs can be printed as PRIsparsepcvec
-  auto handle_sparsematvec = trio_register(cvec_print<sparsematvec>, "m%p"); // sparsematvecs can be printed as PRIsparsematvec
-  auto handle_hollowpcvec = trio_register(cvec_print<hollowpcvec>, "h%p"); // hollowpcvecs can be printed as PRIhollowpcvec
+  FILE *BinaryFile = nullptr;
+  const char *InputFileName, *CheckpointFile = nullptr, *ResumeFile = nullptr;
+
+  const char *mode = WidenCheckpoint ? "a" : "w"; // continue logs when widening
+
+  RegisterPrinters();
+
+  static const struct option longopts[] = {
+    { "matrix-mem", required_argument, nullptr, 'm' },
+    { "spill-dir", required_argument, nullptr, 'd' },
+    { "no-markowitz", no_argument, nullptr, 'p' },
+#if MATCOEFF_P == 0
+    { "size-reduce", no_argument, nullptr, 'r' },
 #endif
-  
-  while ((c = getopt (argc, argv, "ACDF:GhJL:MN:PTW:Z")) != -1)
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  optind = 1;
+  while ((c = getopt_long (argc, argv, "AB:CDF:GhJK:L:MN:PR:S:t:TW:Z", longopts, nullptr)) != -1)
     switch (c) {
     case 'A':
       PrintGap++;
       break;
+    case 'B':
+      if (WidenResult) // written by the copy that called widen()
+	break;
+      BinaryFile = fopen(optarg, "w");
+      if (BinaryFile == NULL)
+	abortprintf(1, "I can't open binary output file '%s'", optarg);
+      break;
     case 'C':
       PrintCompact ^= true;
       break;
@@ -178,6 +205,8 @@ int main(int argc, char **argv) {
       Debug++;
       break;
     case 'F':
+      if (WidenResult)
+	break;
       OutputFile = fopen(optarg, "w");
       if (OutputFile == NULL)
 	abortprintf(1, "I can't open output file '%s'", optarg);
@@ -200,25 +229,72 @@ int main(int argc, char **argv) {
       Jennings = true;
       break;
 #endif
+    case 'K':
+      CheckpointFile = optarg;
+      break;
 #if PCCOEFF_P == 0
     case 'T':
       TorsionFree = true;
       break;
 #endif
     case 'L':
-      LogFile = fopen(optarg, "w");
+      LogFile = fopen(optarg, mode);
       if (LogFile == NULL)
 	abortprintf(1, "I can't open log file '%s'", optarg);
       break;
     case 'M':
       Metabelian = true;
       break;
+    case 'm': {
+      char *end;
+      errno = 0;
+      unsigned long long size = strtoull(optarg, &end, 10);
+      unsigned shift = 0;
+      switch (*end) {
+      case 'G': shift += 10; // fall through
+      case 'M': shift += 10; // fall through
+      case 'k': shift += 10; end++;
+      }
+      if (!isdigit(*optarg) || *end != 0)
+	abortprintf(1, "Memory size '%s' should be a number, optionally followed by k, M or G", optarg);
+      if (errno == ERANGE || size == 0 || size > (SIZE_MAX >> 4) >> shift) // the disk takes 16 times more
+	abortprintf(1, "Memory size '%s' should be positive, and not too large", optarg);
+      MatrixMemory = size << shift;
+      break;
+    }
+    case 'd':
+      SpillDirectory = optarg;
+      break;
+    case 'p':
+      MarkowitzPivots = false;
+      break;
+#if MATCOEFF_P == 0
+    case 'r':
+      SizeReduce = true;
+      break;
+#endif
     case 'N':
       NilpotencyClass = atoi(optarg);
       break;
     case 'P':
       PrintDefs ^= true;
       break;
+    case 'R':
+      ResumeFile = optarg;
+      break;
+    case 'S':
+      StatsFile = fopen(optarg, mode);
+      if (StatsFile == NULL)
+	abortprintf(1, "I can't open statistics file '%s'", optarg);
+      break;
+    case 't': {
+      char *end;
+      unsigned long n = strtoul(optarg, &end, 10);
+      if (!isdigit((unsigned char) optarg[0]) || *end != 0 || n < 1 || n > MAXTHREADS)
+	abortprintf(1, "The number of threads '%s' should be a number between 1 and %u", optarg, MAXTHREADS);
+      NrThreads = n;
+      break;
+    }
     case 'W':
       MaxWeight = atoi(optarg);
       break;
@@ -240,7 +316,9 @@ int main(int argc, char **argv) {
   if (optind != argc)
     abortprintf(1, "I need at most two arguments, as input filename and maximal weight\n%s", USAGE);
 
-  {
+  if (WidenCheckpoint)
+    fprintf(LogFile, "# continuing with coefficients [pc=%s, mat=%s]\n", pccoeff::COEFF_ID(), matcoeff::COEFF_ID());
+  else {
     char hostname[128];
     gethostname(hostname, 128);
 
@@ -274,43 +352,105 @@ int main(int argc, char **argv) {
     fprintf(LogFile, "# flags %s; nilpotency class %s; maximal weight %s\n\n", flags, utoa(nstring, 20, NilpotencyClass), utoa(mstring, 20, MaxWeight));
   }
   
-  fppresentation fppres(InputFileName, Jacobson);
+  std::string input; // kept, to pass it on if coefficients overflow
+#ifdef NQ_WIDER
+  input = readinput(InputFileName);
+#endif
+  if (WidenInput)
+    input = *WidenInput;
+
+  FILE *InputFile;
+  if (!input.empty())
+    InputFile = fmemopen(&input[0], input.size(), "r");
+  else if (InputFileName == nullptr)
+    InputFile = stdin;
+  else
+    InputFile = fopen(InputFileName, "r");
+  if (InputFile == NULL)
+    abortprintf(1, "Can't open input file '%s'", InputFileName);
+  fppresentation fppres(InputFile, InputFileName ? InputFileName : "<stdin>", Jacobson);
+  if (InputFile != stdin)
+    fclose(InputFile);
     
 #ifdef MEMCHECK
   mtrace();
 #endif
 
-  pcpresentation pc(fppres);
-  pc.Graded = Graded;
-  pc.Metabelian = Metabelian;
+  auto newpresentation = [&]() {
+    pcpresentation *pc = new pcpresentation(fppres);
+    pc->Graded = Graded;
+    pc->Metabelian = Metabelian;
 #ifdef LIEALG
-  pc.Jacobson = Jacobson;
+    pc->Jacobson = Jacobson;
 #else
-  pc.Jennings = Jennings;
+    pc->Jennings = Jennings;
 #endif
-  pc.TorsionFree = TorsionFree;
-  pc.NilpotencyClass = NilpotencyClass;
-
-  for (pc.Class = 1; pc.Class <= MaxWeight; pc.Class++) {
-    unsigned oldnrpcgens = pc.NrPcGens;
-
-    unsigned nrcentralgens = pc.addtails(); // add fresh tails
+    pc->TorsionFree = TorsionFree;
+    pc->NilpotencyClass = NilpotencyClass;
+    return pc;
+  };
+  std::unique_ptr<pcpresentation> pcp(newpresentation());
+
+  if (WidenCheckpoint) {
+    loadcheckpoint(*pcp, *WidenCheckpoint);
+    if (CheckpointFile == nullptr)
+      CheckpointFile = ResumeFile;
+  } else if (ResumeFile) {
+    try {
+      pcp->loadcheckpoint(ResumeFile);
+    } catch (const coeff_overflow &e) {
+      abortprintf(1, "%s", e.what());
+    }
+    fprintf(LogFile, "# resumed from checkpoint \"%s\" at class %d, with %d generator%s\n", ResumeFile, pcp->Class, pcp->NrPcGens, plural(pcp->NrPcGens));
+    if (pcp->Class > MaxWeight)
+      abortprintf(1, "Checkpoint has class %d, more than the maximal weight %d", pcp->Class, MaxWeight);
+    if (CheckpointFile == nullptr)
+      CheckpointFile = ResumeFile;
+  }
 
-    {
-      matrix m(nrcentralgens, pc.NrPcGens+1, TorsionFree);
-      
-      pc.consistency(m); // enforce Jacobi and Z-linearity, via queue
+  StatsRecord(pcp->Class, "start");
 
-      m.flushqueue();
-      
-      pc.evalrels(m);
+  while (pcp->Class < MaxWeight) {
+    pcpresentation &pc = *pcp;
+    unsigned oldnrpcgens = pc.NrPcGens;
 
-      m.hermite();
-    
-      pc.reduce(m); // quotient the cover by rels
+    int newgens;
+    try {
+      newgens = pc.nextclass();
+    } catch (const coeff_overflow &e) {
+      fprintf(LogFile, "# %s in class %d\n", e.what(), pc.Class);
+#ifdef NQ_WIDER
+      /* compute this class with arbitrary-precision integers, from the
+	 previous class, and continue with the result if it fits */
+      pc.abandonclass();
+      std::string state = checkpoint(pc), next;
+      fflush(nullptr);
+      UnregisterPrinters();
+      NQ_WIDER::widen(argc, argv, input, state, &next);
+      RegisterPrinters();
+      // the other copy appended to the log and statistics
+      if (LogFile != stdout)
+	fseek(LogFile, 0, SEEK_END);
+      if (StatsFile != nullptr)
+	fseek(StatsFile, 0, SEEK_END);
+
+      pcp.reset(newpresentation());
+      if (!loadcheckpoint(*pcp, next)) { // stay with arbitrary-precision integers
+	fflush(nullptr);
+	UnregisterPrinters();
+	exit(NQ_WIDER::widen(argc, argv, input, next, nullptr));
+      }
+      fprintf(LogFile, "# continuing with coefficients [pc=%s, mat=%s]\n", pccoeff::COEFF_ID(), matcoeff::COEFF_ID());
+      if (MaxWeight == -1u && pcp->NrPcGens == oldnrpcgens)
+	break;
+      continue;
+#else
+      if (CheckpointFile)
+	abortprintf(2, "Coefficient overflow; resume from checkpoint \"%s\" with arbitrary-precision integers, e.g. with \"anq -r 0_0 -R\"", CheckpointFile);
+      else
+	abortprintf(2, "Coefficient overflow; restart with arbitrary-precision integers, e.g. with \"anq -r 0_0\"");
+#endif
     }
-    
-    int newgens = pc.NrPcGens-oldnrpcgens;
     fprintf(LogFile, "# The %d%s factor has %d generator%s", pc.Class, ordinal(pc.Class), newgens, plural(newgens));
     if (newgens) {
       fprintf(LogFile, " of relative order%s ", plural(newgens));
@@ -325,23 +465,56 @@ int main(int argc, char **argv) {
     }
     fprintf(LogFile,"\n");
 
+    if (CheckpointFile) {
+      pc.savecheckpoint(CheckpointFile);
+      StatsRecord(pc.Class, "checkpoint");
+    }
+
+    if (WidenResult) { // back to the copy that called widen()
+      *WidenResult = checkpoint(pc);
+      if (LogFile != stdout)
+	fclose(LogFile);
+      if (StatsFile != nullptr)
+	fclose(StatsFile);
+      LogFile = stdout;
+      StatsFile = nullptr;
+      UnregisterPrinters();
+      return 0;
+    }
+
     if (MaxWeight == -1u && newgens == 0)
       break;
   }
 
+  pcpresentation &pc = *pcp;
+
   if (PrintGap > 0)
     pc.printGAP(OutputFile, PrintGap);  
   else
     pc.print(OutputFile, PrintCompact, PrintDefs, PrintZeros);
 
+  if (BinaryFile) {
+    pc.printbinary(BinaryFile);
+    if (fclose(BinaryFile) != 0)
+      abortprintf(1, "I can't write binary output: %s", strerror(errno));
+  }
+
   TimeStamp("main()");
 
-#ifndef NO_TRIO
-  trio_unregister(handle_hollowpcvec);
-  trio_unregister(handle_sparsematvec);
-  trio_unregister(handle_sparsepcvec);
-  trio_unregister(handle_pccoeff);
-#endif
+  UnregisterPrinters();
   
   return 0;
 }
+
+/* restart main() with the same arguments, from a checkpoint made by
+ * another copy of nq whose coefficients overflowed. If result is set,
+ * compute only the next class, and return its checkpoint there */
+int widen(int argc, char **argv, const std::string &input, const std::string &checkpoint, std::string *result) {
+  WidenInput = &input;
+  WidenCheckpoint = &checkpoint;
+  WidenResult = result;
+  Debug = 0; // main() counts the -D again
+  return main(argc, argv);
+}
+
+END_NQ
@@ -15,6 +15,23 @@
 #include <unordered_set>
 #include "ring.hh"
 #include "vectors.hh"
+#include "threads.hh"
+
+/****************************************************************
+ * a binary may contain several copies of nq, for different algebras
+ * and coefficients (see anq.cc). Each copy is then compiled in its own
+ * namespace NQ_NAMESPACE, except the declarations involving only
+ * global types, such as coefficients and their vectors.
+ */
+#ifdef NQ_NAMESPACE
+#define BEGIN_NQ namespace NQ_NAMESPACE {
+#define END_NQ }
+#define NQNAME(name) NQ_NAMESPACE::name
+#else
+#define BEGIN_NQ
+#define END_NQ
+#define NQNAME(name) ::name
+#endif
 
 /****************************************************************
  * the code will work for groups, Lie and associative algebras, with
@@ -49,10 +66,34 @@ inline const char *plural(unsigned n) {
 // some global variables dictating the behaviour of nq; in particular,
 // the debug level and printing and timestamp routines
 
+BEGIN_NQ
 extern unsigned Debug;
+extern unsigned NrThreads; // number of worker threads, or 1 to run serially
+extern size_t MatrixMemory; // bytes of matrix queue kept in memory, the rest is spilled to disk; 0 = no limit
+extern const char *SpillDirectory; // where to spill, or nullptr for tmpfile()
+extern bool MarkowitzPivots; // in the matrix, a new row may replace a pivot with a longer or non-unit one, or of higher valuation
+extern bool SizeReduce; // over Z, keep the entries of the matrix rows small during elimination
 extern FILE *LogFile;
+extern bool ThrowOnAbort; // abortprintf() throws std::runtime_error rather than exit
 void abortprintf(int, const char *, ...) __attribute__((format(__printf__, 2, 3),noreturn));
 void TimeStamp(const char *);
+void RegisterPrinters(); // so PRIpccoeff etc. can be used
+void UnregisterPrinters();
+
+// counters reported with -S, one JSON record per phase; see
+// StatsRecord(). They are only updated from the calling thread, never
+// from workers.
+struct statistics {
+  uint64_t newgens; // tails added by addtails()
+  uint64_t queued, duplicates; // rows given to matrix::queuerow(), and those already in the queue
+  uint64_t nnzbefore, nnzafter; // matrix entries entering and leaving matrix::flushqueue()
+  uint64_t keptrows; // rows that matrix::add1row() added to the row space
+  uint64_t eliminated; // generators removed by pcpresentation::reduce()
+};
+extern statistics Stats;
+extern FILE *StatsFile;
+void StatsRecord(unsigned, const char *);
+END_NQ
 
 /****************************************************************
  * there are 3 kinds of coefficients:
@@ -95,7 +136,7 @@ namespace std {
 
 typedef sparsevec<pccoeff> sparsepcvec;
 typedef sparsepcvec::key gen;
-struct hollowpcvec;
+BEGIN_NQ struct hollowpcvec; END_NQ
 typedef std::vector<sparsepcvec> sparsepcmat; // compressed rows
 namespace std {
   template<> struct hash<sparsepcvec> : public sparsepcvec::hash { };
@@ -130,10 +171,11 @@ inline bool operator<(const hollowmatvec &vec1, const hollowmatvec &vec2) { retu
 #else
 typedef pccoeff matcoeff;
 typedef sparsepcvec sparsematvec;
-typedef hollowpcvec hollowmatvec;
+typedef NQNAME(hollowpcvec) hollowmatvec;
 typedef sparsepcmat sparsematmat;
 #endif
 
+BEGIN_NQ
 /****************************************************************
  * matrix functions.
  * matrices are stored as std::vector<sparsecvec>
@@ -152,11 +194,29 @@ class matrix {
   const unsigned nrcols, shift;
   const bool torsionfree;
   sparsematmat rows;
-  std::unordered_set<sparsematvec> queue;
+  sparsematmat queue; // rows waiting for flushqueue(), normalized by their leading unit
+  size_t queuebytes; // memory taken by queue
+  FILE *spillfile; // queued rows beyond MatrixMemory
+  std::vector<uint64_t> spilled; // offsets of the rows in spillfile, followed by its end
+  std::unordered_map<uint64_t,unsigned> fingerprints; // of queued rows, to skip duplicates
   mutable vec_supply<hollowmatvec> rowstack;
+  sparsematmat saved; // the rows before flushqueue(), while it runs
+  unsigned fullcols; // columns [0,fullcols) have unit pivots
 
   void inittorsion();
-  bool add1row(hollowmatvec);
+  void droprow(unsigned);
+  void spillrow(const sparsematvec &);
+  sparsematvec unspillrow(size_t) const;
+  void closespill();
+  bool isqueued(unsigned, const sparsematvec &) const;
+  void flushrows(sparsematmat &);
+  bool add1row(hollowmatvec, unsigned = -1U);
+  void hermiterow(unsigned, unsigned, vec_supply<hollowmatvec> &, bool);
+  void sizereduce(hollowmatvec &, unsigned);
+  void sizereduce(unsigned);
+  void howell();
+  void addrows(sparsematmat &, const std::vector<int> &, bool);
+  bool modularhnf(const sparsematmat &, const std::vector<int> &);
  public:
   matrix(unsigned, unsigned, bool);
   ~matrix();
@@ -164,6 +224,7 @@ class matrix {
   bool addrow(hollowpcvec);
   sparsepcvec reducerow(const sparsepcvec &) const;
   void flushqueue();
+  bool full();
   void hermite();
   sparsepcvec getrel(pccoeff &, gen) const;
 };
@@ -234,10 +295,15 @@ struct fppresentation {
   std::vector<std::string> GeneratorName;
   std::vector<node *> Relators, Aliases, Endomorphisms;
 
-  explicit fppresentation(const char *, bool);
+  explicit fppresentation(bool);
+  fppresentation(const char *, bool);
+  fppresentation(FILE *, const char *, bool);
   ~fppresentation();
+  gen addgen(const std::string &, unsigned);
+  void addrel(node *);
   void printnode(FILE *f, const node *) const;
 private:
+  void parse(FILE *, const char *);
   void printnodes(FILE *f, const node *n, nodetype t) const;
 };
 
@@ -274,6 +340,26 @@ struct deftype {
   } a;
 };
 
+/****************************************************************
+ * nq can be used as a library, by linking with libnq_l.a, libnq_g.a,
+ * libnq_l_2_1.a etc. (see the Makefile). For example,
+ *
+ *   ThrowOnAbort = true;
+ *   fppresentation fp(false);
+ *   gen x = fp.addgen("x", 1), y = fp.addgen("y", 1);
+ *   fp.addrel(new node(TBRACK, new node(TBRACK, new node(TGEN, x), new node(TGEN, y)), new node(TGEN, y)));
+ *   pcpresentation pc(fp);
+ *   while (pc.Class < 5) {
+ *     unsigned newgens = pc.nextclass();
+ *     ... // read pc.Generator, pc.Exponent, pc.Power, pc.Comm, pc.Epimorphism
+ *   }
+ *
+ * a presentation may also be read from a FILE *, e.g. from fmemopen().
+ * fp must outlive pc. If nextclass() throws coeff_overflow,
+ * pc.abandonclass() returns pc to the previous class; after any other
+ * exception, pc should be discarded.
+ * RegisterPrinters() must be called before pc.print() etc.
+ */
 struct pcpresentation {
   const fppresentation &fp;
 #ifdef ASSOCALG
@@ -304,16 +390,24 @@ struct pcpresentation {
   explicit pcpresentation(const fppresentation &);
   ~pcpresentation();
 
+  unsigned nextclass();
+  void abandonclass();
   unsigned addtails();
   void consistency(matrix &) const;
   void evalrels(matrix &);
   void reduce(const matrix &);
   void print(FILE *f, bool, bool, bool) const;
   void printGAP(FILE *f, int) const;
+  void printbinary(FILE *f) const;
+  void savecheckpoint(const char *) const;
+  void savecheckpoint(FILE *) const;
+  void loadcheckpoint(const char *);
+  void loadcheckpoint(FILE *, const char *);
 private:
   void add1generator(sparsepcvec &, deftype);
+  void paralleltails(const std::vector<std::pair<gen,gen>> &);
   inline bool isgoodweight_comm(int i, int j) const;
-  void collecttail(sparsepcvec &, const matrix &m, std::vector<int>);
+  void collecttail(sparsepcvec &, const matrix &m, const std::vector<int> &, const std::vector<sparsepcvec> &);
   unsigned NrTotalGens; // number of current+tail ai in extended presentation
 };
 
@@ -370,24 +464,26 @@ struct hollowpcvec : hollowvec<pccoeff> {
 #endif
 };
 
-// a global stack to supply with very low overhead a fresh vector
-extern vec_supply<hollowpcvec> vecstack;
+// a stack, one per thread, to supply with very low overhead a fresh vector
+extern thread_local vec_supply<hollowpcvec> vecstack;
 
-inline bool operator==(const sparsepcvec &vec1, const sparsepcvec &vec2) { return vec_equal(vec1, vec2); }
 inline bool operator==(const sparsepcvec &vec1, const hollowpcvec &vec2) { return vec_equal(vec1, vec2); }
 inline bool operator==(const hollowpcvec &vec1, const sparsepcvec &vec2) { return vec_equal(vec1, vec2); }
 inline bool operator==(const hollowpcvec &vec1, const hollowpcvec &vec2) { return vec_equal(vec1, vec2); }
-inline bool operator!=(const sparsepcvec &vec1, const sparsepcvec &vec2) { return !vec_equal(vec1, vec2); }
 inline bool operator!=(const sparsepcvec &vec1, const hollowpcvec &vec2) { return !vec_equal(vec1, vec2); }
 inline bool operator!=(const hollowpcvec &vec1, const sparsepcvec &vec2) { return !vec_equal(vec1, vec2); }
 inline bool operator!=(const hollowpcvec &vec1, const hollowpcvec &vec2) { return !vec_equal(vec1, vec2); }
-inline bool operator<(const sparsepcvec &vec1, const sparsepcvec &vec2) { return vec_cmp(vec1, vec2) < 0; }
 inline bool operator<(const sparsepcvec &vec1, const hollowpcvec &vec2) { return vec_cmp(vec1, vec2) < 0; }
 inline bool operator<(const hollowpcvec &vec1, const sparsepcvec &vec2) { return vec_cmp(vec1, vec2) < 0; }
 inline bool operator<(const hollowpcvec &vec1, const hollowpcvec &vec2) { return vec_cmp(vec1, vec2) < 0; }
+END_NQ
+
+inline bool operator==(const sparsepcvec &vec1, const sparsepcvec &vec2) { return vec_equal(vec1, vec2); }
+inline bool operator!=(const sparsepcvec &vec1, const sparsepcvec &vec2) { return !vec_equal(vec1, vec2); }
+inline bool operator<(const sparsepcvec &vec1, const sparsepcvec &vec2) { return vec_cmp(vec1, vec2) < 0; }
 
 namespace std {
-  template<> struct hash<hollowpcvec> : public hollowpcvec::hash { };
+  template<> struct hash<NQNAME(hollowpcvec)> : public NQNAME(hollowpcvec)::hash { };
 }
 
 #ifndef NO_TRIO
@@ -8,7 +8,9 @@
 #include "nq.h"
 #include <map>
 
-vec_supply<hollowpcvec> vecstack;
+BEGIN_NQ
+
+thread_local vec_supply<hollowpcvec> vecstack;
 
 /* general collector, to be run at end of computations if "all powers
  * commute" (Lie algebra, assoc algebra, tails of group)
@@ -259,19 +261,21 @@ constexpr conjdict_entry top_conj_entry(gen g) {
 }
 typedef std::unordered_map<conjdict_entry,sparsepcvec> conjdict_map;
 
+END_NQ
 namespace std {
-  template<> struct hash<conjdict_entry> {
-    size_t operator()(const conjdict_entry &key) const {
+  template<> struct hash<NQNAME(conjdict_entry)> {
+    size_t operator()(const NQNAME(conjdict_entry) &key) const {
       return (key.g << 16) + (key.p_pow << 8) + key.two_pow;
     }
   };
 
-  template<> struct equal_to<conjdict_entry> {
-    bool operator()(const conjdict_entry &key1, const conjdict_entry &key2) const {
+  template<> struct equal_to<NQNAME(conjdict_entry)> {
+    bool operator()(const NQNAME(conjdict_entry) &key1, const NQNAME(conjdict_entry) &key2) const {
       return key1.g == key2.g && key1.p_pow == key2.p_pow && key1.two_pow == key2.two_pow;
     }   
   };
 }
+BEGIN_NQ
 
 // the following functions compute g^(h^c) using cache. assume g > h.
 
@@ -895,3 +899,5 @@ void hollowpcvec::eval(const pcpresentation &pc, node *rel) {
 }
 
 #endif
+
+END_NQ
@@ -6,9 +6,12 @@
 */
 
 #include "nq.h"
+#include "anqread.h"
 #include <vector>
 #include <deque>
 
+BEGIN_NQ
+
 #ifdef ASSOCALG
 static sparsepcvec unit_vector(gen g)
 {
@@ -26,6 +29,13 @@ pcpresentation::pcpresentation(const fppresentation &pres) : fp(pres) {
   NrPcGens = 0;
   Class = 0;
   LastGen = {0};
+  Graded = Metabelian = TorsionFree = false;
+#ifdef LIEALG
+  Jacobson = false;
+#else
+  Jennings = false;
+#endif
+  NilpotencyClass = -1u;
   
   Epimorphism.resize(pres.NrGens + 1);
   Epimorphism[0] = sparsepcvec::bad(); // guard
@@ -137,6 +147,165 @@ static hollowpcvec tail_pow(const pcpresentation &pc, gen f, gen g) {
 }
 #endif
 
+/* return fresh correct tail for [aj,ai], or aj*ai in associative
+ * algebras, computed from the definition of ai or aj.
+ */
+static hollowpcvec tail_comm(const pcpresentation &pc, gen j, gen i) {
+#ifdef ASSOCALG
+  hollowpcvec tail = vecstack.fresh();
+
+  /* compute the correct tail for aj*ai: in associative algebra
+   * - if ai is defined as g*h, compute aj*ai = (aj*g)*h
+   * - if ai is defined as N*g, compute aj*ai = N*(aj*g)
+   */
+
+  if (pc.Generator[i].type == DCOMM) { /* ai = g*h */
+    gen g = pc.Generator[i].a.g, h = pc.Generator[i].a.h;
+    tail.assocprod(pc, pc.Prod[j][g], h);
+    tail.collect(pc);
+  } else if (pc.Generator[i].type == DPOW) { /* ai = N*g */
+  } else if (pc.Generator[j].type == DPOW) { /* aj = N*g */
+  } else
+    abortprintf(4, "AddTails: unknown definition for [a%d,a%d]", j, i);
+#elif defined(LIEALG)
+  hollowpcvec tail = vecstack.fresh();
+
+  /* compute the correct tail for [aj,ai]: in Lie algebra,
+   * - if ai is defined as [g,h], compute [aj,ai] = [aj,g,h]-[aj,h,g]
+   * - if ai is defined as N*g, compute [aj,ai] = N*[aj,g]
+   * - if aj is defined as N*g, compute [aj,ai] = N*[g,ai] or -N*[ai,g].
+   */
+
+  if (pc.Generator[i].type == DCOMM) { /* ai = [g,h] */
+    gen g = pc.Generator[i].a.g, h = pc.Generator[i].a.h;
+    tail.lie3bracket(pc, j, g, h, true); // +[[aj,g],h]
+    tail.lie3bracket(pc, j, h, g, false); // -[[aj,h],g]
+    tail.collect(pc);
+  } else if (pc.Generator[i].type == DPOW) { /* ai = N*g */
+    gen g = pc.Generator[i].a.p;
+    if (pc.Jacobson)
+      tail.engel(pc, j, g, pccoeff::characteristic, true);
+    else
+      tail.addmul(pc.Exponent[g], pc.Comm[j][g]);
+    tail.collect(pc);
+  } else if (pc.Generator[j].type == DPOW) { /* aj = N*g */
+    gen g = pc.Generator[j].a.p;
+    if (pc.Jacobson)
+      tail.engel(pc, i, g, pccoeff::characteristic, false);
+    else {
+      if (g > i)
+	tail.addmul(pc.Exponent[g], pc.Comm[g][i]);
+      else if (g < i)
+	tail.submul(pc.Exponent[g], pc.Comm[i][g]);
+    }
+    tail.collect(pc);
+  } else
+    abortprintf(4, "AddTails: unknown definition for [a%d,a%d]", j, i);
+#elif defined(GROUP)
+  hollowpcvec tail;
+
+  /* compute the correct tail for [aj,ai]: in groups,
+   * - if ai is defined as [g,h], compute [aj,ai] *= (aj(gh))^-1 * (ajg)h
+   * - if ai is defined as g^N, compute [aj,ai] *= (aj g^N)^-1 * (ajg)g^(N-1)
+   * - if aj is defined as g^N, compute [aj,ai] *= (g^N a_i)^-1 * (g^(N-1)*(g*a_i))
+   */
+
+  if (pc.Generator[i].type == DCOMM) /* ai = [g,h] */
+    tail = tail_assoc(pc, j, pc.Generator[i].a.g, pc.Generator[i].a.h);
+  else if (pc.Generator[i].type == DPOW) { /* ai = g^N */
+    tail = tail_pow(pc, j, pc.Generator[i].a.p);
+    tail.neg();
+  } else if (pc.Generator[j].type == DPOW) { /* aj = g^N */
+    abortprintf(4, "AddTails: Generators[%d].type == DPOW shouldn't occur", j);
+    // @@@ unused now; tail seems too hard to compute because of
+    // order in which the commutators are set up
+    tail = tail_pow(pc, i, pc.Generator[j].a.p);
+  } else
+    abortprintf(4, "AddTails: unknown definition for [a%d,a%d]", j, i);
+#endif
+  return tail;
+}
+
+static void printtail(const pcpresentation &pc, gen j, gen i, const hollowpcvec &tail) {
+#ifdef ASSOCALG
+  if (pc.Generator[i].type == DCOMM) { /* ai = g*h */
+    gen g = pc.Generator[i].a.g, h = pc.Generator[i].a.h;
+    fprintf(LogFile, "# tail: a%d*a%d = (a%d*a%d)*a%d = " PRIhollowpcvec "\n", j, i, j, g, h, &tail);
+  } else if (pc.Generator[i].type == DPOW) { /* ai = N*g */
+    gen g = 0;
+    fprintf(LogFile, "# tail: [a%d,a%d] = " PRIpccoeff "*[a%d,a%d] = " PRIhollowpcvec "\n", j, i, &pc.Exponent[g], j, g, &tail);
+  } else if (pc.Generator[j].type == DPOW) { /* aj = N*g */
+    gen g = 0;
+    fprintf(LogFile, "# tail: [a%d,a%d] = " PRIpccoeff "*[a%d,a%d] = " PRIhollowpcvec "\n", j, i, &pc.Exponent[g], g, i, &tail);
+  }
+#elif defined(LIEALG)
+  if (pc.Generator[i].type == DCOMM) { /* ai = [g,h] */
+    gen g = pc.Generator[i].a.g, h = pc.Generator[i].a.h;
+    fprintf(LogFile, "# tail: [a%d,a%d] = [a%d,[a%d,a%d]] = " PRIhollowpcvec "\n", j, i, j, g, h, &tail);
+  } else if (pc.Generator[i].type == DPOW) { /* ai = N*g */
+    gen g = pc.Generator[i].a.p;
+    fprintf(LogFile, "# tail: [a%d,a%d] = " PRIpccoeff "*[a%d,a%d] = " PRIhollowpcvec "\n", j, i, &pc.Exponent[g], j, g, &tail);
+  } else if (pc.Generator[j].type == DPOW) { /* aj = N*g */
+    gen g = pc.Generator[j].a.p;
+    fprintf(LogFile, "# tail: [a%d,a%d] = " PRIpccoeff "*[a%d,a%d] = " PRIhollowpcvec "\n", j, i, &pc.Exponent[g], g, i, &tail);
+  }
+#elif defined(GROUP)
+  if (pc.Generator[i].type == DCOMM) /* ai = [g,h] */
+    fprintf(LogFile, "# tail: [a%d,a%d] = [a%d,[a%d,a%d]] *= " PRIhollowpcvec "\n", j, i, j, pc.Generator[i].a.g, pc.Generator[i].a.h, &tail);
+  else if (pc.Generator[i].type == DPOW) /* ai = g^N */
+    fprintf(LogFile, "# tail: [a%d,a%d] = [a%d,a%d^" PRIpccoeff "] *= " PRIhollowpcvec "\n", j, i, j, pc.Generator[i].a.p, &pc.Exponent[pc.Generator[i].a.p], &tail);
+  else if (pc.Generator[j].type == DPOW) /* aj = g^N */
+    fprintf(LogFile, "# tail: [a%d,a%d] = [a%d^" PRIpccoeff ",a%d] *= " PRIhollowpcvec "\n", j, i, pc.Generator[j].a.p, &pc.Exponent[pc.Generator[j].a.p], i, &tail);
+#endif
+}
+
+/* the part of Comm[j][i] (or Prod[j][i]) that is already set, and
+ * should agree with the tail computed by tail_comm. The rest of the
+ * tail, which lies in the centre, is appended to it.
+ */
+static unsigned tailprefix(const pcpresentation &pc, gen j, gen i) {
+#ifdef ASSOCALG
+  return pc.Prod[j][i].size();
+#elif defined(LIEALG)
+  return pc.Comm[j][i].size();
+#elif defined(GROUP)
+  return 0;
+#endif
+}
+
+static void settail(pcpresentation &pc, gen j, gen i, const hollowpcvec &tail) {
+#ifdef ASSOCALG
+  sparsepcvec &v = pc.Prod[j][i];
+#else
+  sparsepcvec &v = pc.Comm[j][i];
+#endif
+#ifdef GROUP
+  if (!tail.empty()) {
+    if (tail.begin()->first <= pc.NrPcGens)
+      abortprintf(5, "Addtails: adjustment to tail of [a%d,a%d] doesn't lie in centre", j, i);
+
+    unsigned len = v.size();
+	
+    v.resize(len, len+tail.size());
+    v.window(len).copy(tail);
+  }
+#else
+  unsigned len = 0;
+  auto tp = tail.begin();
+  for (const auto &kc : v) {
+    if (kc.first != (*tp).first || cmp(kc.second,(*tp).second))
+      abortprintf(5, "AddTails: adjustment to tail of [a%d,a%d] doesn't lie in centre", j, i);
+    len++;
+    tp++;
+  }
+
+  if (tp != tail.end()) {
+    v.resize(len, tail.size());
+    v.window(len).copy(tp, tail.end());
+  }
+#endif
+}
+
 // should [i,j] receive a tail?
 inline bool pcpresentation::isgoodweight_comm(int i, int j) const {
   unsigned totalweight = Generator[i].w + Generator[j].w;
@@ -361,182 +530,418 @@ unsigned pcpresentation::addtails() {
   /* Some of the newly introduced generators strictly depend on one
    * another hence we can compute them inductively.
    */
-  for (unsigned j = NrPcGens; j >= 1; j--) {
-#ifdef ASSOCALG
+  std::vector<std::pair<gen,gen>> tails; // the [aj,ai] to compute, in order
+  for (unsigned j = NrPcGens; j >= 1; j--)
     for (unsigned i = 1; i <= NrPcGens; i++) {
-      if (!isgoodweight_comm(i, j))
-	continue;
-	  
+#ifdef ASSOCALG
       if (Generator[i].type == DGEN) /* nothing to do, aj*ai is a defining generator */
-	  continue;
-
-      hollowpcvec tail = vecstack.fresh();
-
-    /* compute the correct tail for aj*ai: in associative algebra
-     * - if ai is defined as g*h, compute aj*ai = (aj*g)*h
-     * - if ai is defined as N*g, compute aj*ai = N*(aj*g)
-     */
-
-      if (Generator[i].type == DCOMM) { /* ai = g*h */
-	gen g = Generator[i].a.g, h = Generator[i].a.h;
-	tail.assocprod(*this, Prod[j][g], h);
-	tail.collect(*this);
-
-	if (Debug >= 2)
-	  fprintf(LogFile, "# tail: a%d*a%d = (a%d*a%d)*a%d = " PRIhollowpcvec "\n", j, i, j, g, h, &tail);
-      } else if (Generator[i].type == DPOW) { /* ai = N*g */
-	gen g = 0;
-	if (Debug >= 2)
-	  fprintf(LogFile, "# tail: [a%d,a%d] = " PRIpccoeff "*[a%d,a%d] = " PRIhollowpcvec "\n", j, i, &Exponent[g], j, g, &tail);
-      } else if (Generator[j].type == DPOW) { /* aj = N*g */
-	gen g = 0;
-	if (Debug >= 2)
-	  fprintf(LogFile, "# tail: [a%d,a%d] = " PRIpccoeff "*[a%d,a%d] = " PRIhollowpcvec "\n", j, i, &Exponent[g], g, i, &tail);
-      } else
-	abortprintf(4, "AddTails: unknown definition for [a%d,a%d]", j, i);
-      
-      unsigned len = 0;
-      auto tp = tail.begin();
-      for (const auto &kc : Prod[j][i]) {
-	if (kc.first != (*tp).first || cmp(kc.second,(*tp).second))
-	  abortprintf(5, "AddTails: adjustment to tail of [a%d,a%d] doesn't lie in centre", j, i);
-	len++;
-	tp++;
-      }
-
-      if (tp != tail.end()) {
-	Prod[j][i].resize(len, tail.size());
-	Prod[j][i].window(len).copy(tp, tail.end());
-      }
-      vecstack.release(tail);
-    }
+	continue;
 #elif defined(LIEALG)
-    for (unsigned i = 1; i < j; i++) {
-      if (!isgoodweight_comm(i, j))
+      if (i >= j || (Generator[i].type == DGEN && Generator[j].type != DPOW)) /* nothing to do, [aj,ai] is a defining generator */
 	continue;
-	  
-      if (Generator[i].type == DGEN && Generator[j].type != DPOW) /* nothing to do, [aj,ai] is a defining generator */
+#elif defined(GROUP)
+      if (i >= j || Generator[i].type == DGEN) /* nothing to do, [aj,ai] is a defining generator */
 	continue;
+#endif
+      if (isgoodweight_comm(i, j))
+	tails.push_back(std::make_pair(j, i));
+    }
 
-      hollowpcvec tail = vecstack.fresh();
+  if (NrThreads > 1 && !tails.empty())
+    paralleltails(tails);
+  else
+    for (const auto &ji : tails) {
+      hollowpcvec tail = tail_comm(*this, ji.first, ji.second);
+      if (Debug >= 2)
+	printtail(*this, ji.first, ji.second, tail);
+      settail(*this, ji.first, ji.second, tail);
+      vecstack.release(tail);
+    }
+  
+  Stats.newgens += NrTotalGens - NrPcGens;
+  TimeStamp("pcpresentation::addtails()");
 
-      /* compute the correct tail for [aj,ai]: in Lie algebra,
-       * - if ai is defined as [g,h], compute [aj,ai] = [aj,g,h]-[aj,h,g]
-       * - if ai is defined as N*g, compute [aj,ai] = N*[aj,g]
-       * - if aj is defined as N*g, compute [aj,ai] = N*[g,ai] or -N*[ai,g].
-       */
+  return NrTotalGens - NrPcGens;
+}
 
-      if (Generator[i].type == DCOMM) { /* ai = [g,h] */
-	gen g = Generator[i].a.g, h = Generator[i].a.h;
-	tail.lie3bracket(*this, j, g, h, true); // +[[aj,g],h]
-	tail.lie3bracket(*this, j, h, g, false); // -[[aj,h],g]
-	tail.collect(*this);
+/* compute the tails of all [aj,ai] in tails, in parallel, with the
+ * same result as computing them one after the other.
+ *
+ * the tail of [aj,ai] may use tails of [aj',ai'] set earlier, but
+ * only through their central part, so only linearly. We give each
+ * [aj,ai] a temporary central generator, a "marker", standing for the
+ * adjustment to its tail; compute all tails concurrently; and then
+ * replace the markers by the adjustments they stand for, following
+ * the dependencies between tails.
+ */
+void pcpresentation::paralleltails(const std::vector<std::pair<gen,gen>> &tails) {
+  const unsigned ntails = tails.size(), nrtotalgens = NrTotalGens, marker0 = NrTotalGens + 1;
 
-	if (Debug >= 2)
-	  fprintf(LogFile, "# tail: [a%d,a%d] = [a%d,[a%d,a%d]] = " PRIhollowpcvec "\n", j, i, j, g, h, &tail);
-      } else if (Generator[i].type == DPOW) { /* ai = N*g */
-	gen g = Generator[i].a.p;
-	if (Jacobson)
-	  tail.engel(*this, j, g, pccoeff::characteristic, true);
-	else
-	  tail.addmul(Exponent[g], Comm[j][g]);
-	tail.collect(*this);
+  for (const auto &ji : tails) {
+    gen j = ji.first, i = ji.second;
+#ifdef ASSOCALG
+    add1generator(Prod[j][i], {.type = TEMPCOMM, .w = Class, .cw = Generator[i].cw+Generator[j].cw, .a = {.g = j, .h = i}});
+#else
+    add1generator(Comm[j][i], {.type = TEMPCOMM, .w = Class, .cw = Generator[i].cw+Generator[j].cw, .a = {.g = j, .h = i}});
+#endif
+  }
 
-	if (Debug >= 2)
-	  fprintf(LogFile, "# tail: [a%d,a%d] = " PRIpccoeff "*[a%d,a%d] = " PRIhollowpcvec "\n", j, i, &Exponent[g], j, g, &tail);
-      } else if (Generator[j].type == DPOW) { /* aj = N*g */
-	gen g = Generator[j].a.p;
-	if (Jacobson)
-	  tail.engel(*this, i, g, pccoeff::characteristic, false);
-	else {
-	  if (g > i)
-	    tail.addmul(Exponent[g], Comm[g][i]);
-	  else if (g < i)
-	    tail.submul(Exponent[g], Comm[i][g]);
-	}
-	tail.collect(*this);
+  Exponent.resize(NrTotalGens + 1);
+  Annihilator.resize(NrTotalGens + 1);
+  Power.resize(NrTotalGens + 1);
+#ifdef ASSOCALG
+  Prod.resize(NrTotalGens + 1);
+  Prod[0].resize(NrTotalGens + 1);
+#endif
+  for (unsigned i = marker0; i <= NrTotalGens; i++) {
+    Exponent[i].init();
+    Exponent[i].kernel<matcoeff>();
+    Annihilator[i].init_set_si(0);
+    Power[i].noalloc();
+#ifdef ASSOCALG
+    Prod[i].resize(1);
+    Prod[i][0] = Prod[0][i] = unit_vector(i);
+#endif
+  }
 
-	if (Debug >= 2)
-	  fprintf(LogFile, "# tail: [a%d,a%d] = " PRIpccoeff "*[a%d,a%d] = " PRIhollowpcvec "\n", j, i, &Exponent[g], g, i, &tail);
-      } else
-	abortprintf(4, "AddTails: unknown definition for [a%d,a%d]", j, i);
-      
-      unsigned len = 0;
-      auto tp = tail.begin();
-      for (const auto &kc : Comm[j][i]) {
-	if (kc.first != (*tp).first || cmp(kc.second,(*tp).second))
-	  abortprintf(5, "AddTails: adjustment to tail of [a%d,a%d] doesn't lie in centre", j, i);
-	len++;
-	tp++;
-      }
+  std::vector<sparsepcvec> tail(ntails);
+  size_t vecsize = NrTotalGens;
 
-      if (tp != tail.end()) {
-	Comm[j][i].resize(len, tail.size());
-	Comm[j][i].window(len).copy(tp, tail.end());
+  task_graph(NrThreads, std::vector<std::vector<size_t>>(ntails), std::vector<size_t>(ntails, 0),
+    [vecsize]() { vecstack.setsize(vecsize); },
+    [this, &tails, &tail](size_t t) {
+      hollowpcvec v = tail_comm(*this, tails[t].first, tails[t].second);
+      tail[t] = v.getsparse();
+      vecstack.release(v);
+    });
+
+  // remove the markers
+  for (const auto &ji : tails) {
+#ifdef ASSOCALG
+    sparsepcvec &v = Prod[ji.first][ji.second];
+#else
+    sparsepcvec &v = Comm[ji.first][ji.second];
+#endif
+    unsigned len = v.size() - 1;
+    v.resize(len+1, len);
+    v.truncate(len);
+  }
+  for (unsigned i = marker0; i <= NrTotalGens; i++) {
+    Exponent[i].clear();
+    Annihilator[i].clear();
+#ifdef ASSOCALG
+    Prod[i][0].free();
+#endif
+  }
+  NrTotalGens = nrtotalgens;
+  Generator.resize(NrTotalGens + 1);
+  Exponent.resize(NrTotalGens + 1);
+  Annihilator.resize(NrTotalGens + 1);
+  Power.resize(NrTotalGens + 1);
+#ifdef ASSOCALG
+  Prod.resize(NrTotalGens + 1);
+  Prod[0].resize(NrTotalGens + 1);
+#endif
+
+  /* the marker of [aj',ai'] stands for the adjustment to its tail if
+   * [aj',ai'] comes before [aj,ai], and for 0 otherwise
+   */
+  std::vector<std::vector<size_t>> succ(ntails);
+  std::vector<size_t> npred(ntails, 0);
+  for (unsigned t = 0; t < ntails; t++)
+    for (const auto &kc : tail[t])
+      if (kc.first >= marker0 && kc.first - marker0 < t) {
+	succ[kc.first - marker0].push_back(t);
+	npred[t]++;
       }
-      vecstack.release(tail);
-    }
-#elif defined(GROUP)
-    for (unsigned i = 1; i < j; i++) {
-      if (!isgoodweight_comm(i, j))
-	continue;
-	  
-      if (Generator[i].type == DGEN) /* nothing to do, [aj,ai] is a defining generator */
-	  continue;
 
-      hollowpcvec tail;
+  std::vector<sparsepcvec> adjustment(ntails);
+  vecsize = NrTotalGens;
+  
+  task_graph(NrThreads, succ, npred,
+    [vecsize]() { vecstack.setsize(vecsize); },
+    [this, &tails, &tail, &adjustment, marker0](size_t t) {
+      hollowpcvec v = vecstack.fresh();
+      for (const auto &kc : tail[t])
+	if (kc.first < marker0)
+	  v[kc.first] += kc.second;
+	else if (kc.first - marker0 < t)
+	  v.addmul(kc.second, adjustment[kc.first - marker0]);
+      tail[t].free();
+      tail[t] = v.getsparse();
+      vecstack.release(v);
+
+      unsigned prefix = tailprefix(*this, tails[t].first, tails[t].second), len = tail[t].size();
+      adjustment[t] = tail[t].window(prefix < len ? prefix : len);
+    });
+
+  for (unsigned t = 0; t < ntails; t++) {
+    gen j = tails[t].first, i = tails[t].second;
+    hollowpcvec v = vecstack.fresh();
+    v.copy(tail[t]);
+    tail[t].free();
+    if (Debug >= 2)
+      printtail(*this, j, i, v);
+    settail(*this, j, i, v);
+    vecstack.release(v);
+  }
+}
 
-      /* compute the correct tail for [aj,ai]: in groups,
-       * - if ai is defined as [g,h], compute [aj,ai] *= (aj(gh))^-1 * (ajg)h
-       * - if ai is defined as g^N, compute [aj,ai] *= (aj g^N)^-1 * (ajg)g^(N-1)
-       * - if aj is defined as g^N, compute [aj,ai] *= (g^N a_i)^-1 * (g^(N-1)*(g*a_i))
-       */
+/* compute produce(i) for 0 <= i < n, and pass the results in order to
+ * consume(i, produce(i)). produce(i) returns a fresh vector from
+ * vecstack, which consume() should not release.
+ *
+ * with NrThreads > 1, the production is spread over that many threads,
+ * each with its own vecstack; the consumption still happens in the
+ * calling thread, in order.
+ */
+template <typename P, typename C> static void parallel_ordered(unsigned n, P produce, C consume) {
+  if (NrThreads <= 1) {
+    for (unsigned i = 0; i < n; i++) {
+      hollowpcvec v = produce(i);
+      consume(i, v);
+      vecstack.release(v);
+    }
+    return;
+  }
 
-      if (Generator[i].type == DCOMM) { /* ai = [g,h] */
-	tail = tail_assoc(*this, j, Generator[i].a.g, Generator[i].a.h);
+  const size_t vecsize = vecstack.getsize();
+
+  ordered_pipeline<sparsepcvec>(NrThreads, n, 64*NrThreads,
+    [vecsize]() { vecstack.setsize(vecsize); },
+    [&produce](unsigned i) -> sparsepcvec {
+      hollowpcvec v = produce(i);
+      sparsepcvec s = v.getsparse();
+      vecstack.release(v);
+      return s;
+    },
+    [&consume](unsigned i, sparsepcvec s) {
+      hollowpcvec v = vecstack.fresh();
+      v.copy(s);
+      s.free();
+      consume(i, v);
+      vecstack.release(v);
+    },
+    [](sparsepcvec s) { s.free(); });
+}
 
-	if (Debug >= 2)
-	  fprintf(LogFile, "# tail: [a%d,a%d] = [a%d,[a%d,a%d]] *= " PRIhollowpcvec "\n", j, i, j, Generator[i].a.g, Generator[i].a.h, &tail);
-      } else if (Generator[i].type == DPOW) { /* ai = g^N */
-	tail = tail_pow(*this, j, Generator[i].a.p);
-	tail.neg();
+static const size_t CONSISTENCY_CHUNK = 4096; // checks generated at once
+static const size_t CONSISTENCY_BATCH = 1024; // least number of checks queued between flushes
 
-	if (Debug >= 2)
-	  fprintf(LogFile, "# tail: [a%d,a%d] = [a%d,a%d^" PRIpccoeff "] *= " PRIhollowpcvec "\n", j, i, j, Generator[i].a.p, &Exponent[Generator[i].a.p], &tail);
-      } else if (Generator[j].type == DPOW) { /* aj = g^N */
-	abortprintf(4, "AddTails: Generators[%d].type == DPOW shouldn't occur", j);
-	// @@@ unused now; tail seems too hard to compute because of
-	// order in which the commutators are set up
-	tail = tail_pow(*this, i, Generator[j].a.p);
+/* the consistency checks are independent of each other. Each one
+ * produces a vector that should vanish in the centre.
+ */
+enum consistencytype {
+  CJACOBI, /* Jacobi identity, or associativity, of ai, aj, ak */
+  CTORSION, /* torsion relation of ai */
+  CTORSIONCOMM, /* compatibility of torsion of ai with [ai,aj] or ai*aj */
+#ifdef ASSOCALG
+  CTORSIONCOMMRIGHT, /* compatibility of torsion of ai with aj*ai */
+#endif
+};
 
-	if (Debug >= 2)
-	  fprintf(LogFile, "# tail: [a%d,a%d] = [a%d^" PRIpccoeff ",a%d] *= " PRIhollowpcvec "\n", j, i, Generator[j].a.p, &Exponent[Generator[j].a.p], i, &tail);
-      } else
-	abortprintf(4, "AddTails: unknown definition for [a%d,a%d]", j, i);
+struct consistencycheck {
+  consistencytype type;
+  gen i, j, k;
+};
 
-      if (!tail.empty()) {
-	if (tail.begin()->first <= NrPcGens)
-	  abortprintf(5, "Addtails: adjustment to tail of [a%d,a%d] doesn't lie in centre", j, i);
+// return a fresh vector, which should vanish in the centre
+static hollowpcvec consistencyvec(const pcpresentation &pc, const consistencycheck &c) {
+  const gen i = c.i, j = c.j;
+  
+  switch (c.type) {
+  case CJACOBI:
+    {
+      const gen k = c.k;
+#ifdef LIEALG
+      hollowpcvec t = vecstack.fresh();
+      t.lie3bracket(pc, i, j, k, true);
+      t.lie3bracket(pc, j, k, i, true);
+      t.lie3bracket(pc, k, i, j, true);
+      t.collect(pc);
+      return t;
+#elif defined(GROUP)
+      return tail_assoc(pc, k, j, i);
+#elif defined(ASSOCALG)
+      hollowpcvec t = vecstack.fresh();
+      t.assocprod(pc, pc.Prod[j][i], k, true);
+      t.assocprod(pc, j, pc.Prod[i][k], false);
+      t.collect(pc);
+      return t;
+#endif
+    }
+  case CTORSION:
+    {
+      /* if N*v = 0 in our ring, and we have a power relation A*g = w,
+       * enforce (N/A)*w = 0.
+       * if the group's exponent is given (by the torsion in the
+       * ccoefficients), impose a power relation.
+       */
+      hollowpcvec t = vecstack.fresh();
+      pccoeff annihilator;
+      annihilator.init();
+      unit_annihilator(nullptr, &annihilator, pc.Exponent[i]);
+#ifdef GROUP
+      hollowpcvec u = vecstack.fresh();
+      u.copy(pc.Power[i]);      
+      t.pow(pc, u, annihilator);
+      vecstack.release(u);
+#else
+      t.addmul(annihilator, pc.Power[i]);
+      t.collect(pc);
+#endif      
+      annihilator.clear();
+      return t;
+    }
+  case CTORSIONCOMM:
+    {
+#ifdef LIEALG
+      /* two different meanings:
+       * - in usual Lie algebras, enforce
+           N*[a,b] = [N*a,b] if N is the order of a;
+       * - in restricted Lie algebras, enforce [a,b,...,b] = [a,b^p] */
+      hollowpcvec t = vecstack.fresh();
+
+      // first, we compute -[N*ai,aj] or -[ai^p,aj]
+      for (const auto &kc : pc.Power[i]) {
+	gen g = kc.first;
+	if (g > pc.NrPcGens)
+	  break;
+	if (g > j)
+	  t.submul(kc.second, pc.Comm[g][j]);
+	else if (g < j)
+	  t.addmul(kc.second, pc.Comm[j][g]);
+      }
 
-	unsigned len = Comm[j][i].size();
-	
-	Comm[j][i].resize(len, len+tail.size());
-	Comm[j][i].window(len).copy(tail);
+      if (pc.Jacobson)
+	t.engel(pc, j, i, pccoeff::characteristic, false);
+      else {
+	if (i > j)
+	  t.addmul(pc.Exponent[i], pc.Comm[i][j]);
+	else if (i < j)
+	  t.submul(pc.Exponent[i], pc.Comm[j][i]);
       }
-      vecstack.release(tail);
+      t.collect(pc);
+      return t;
+#elif defined(GROUP)
+      /* enforce a^N*b = a^(N-1)*(a*b) or a*b^N = (a*b)*b^(N-1) in groups
+       */
+      return tail_pow(pc, j, i);
+#elif defined(ASSOCALG)
+      /* enforce N*(a*b) = (N*a)*b and N*(b*a) = b*(N*a) if N is the order of a */
+      hollowpcvec t = vecstack.fresh();
+      t.assocprod(pc, pc.Power[i], j, false);
+      t.addmul(pc.Exponent[i], pc.Prod[i][j]);
+      t.collect(pc);
+      return t;
     }
+  case CTORSIONCOMMRIGHT:
+    {
+      hollowpcvec t = vecstack.fresh();
+      t.assocprod(pc, j, pc.Power[i], false);
+      t.addmul(pc.Exponent[i], pc.Prod[j][i]);
+      t.collect(pc);
+      return t;
 #endif
+    }
   }
-  
-  TimeStamp("pcpresentation::addtails()");
+  abortprintf(5, "consistencyvec: unknown check type %d", c.type);
+}
 
-  return NrTotalGens - NrPcGens;
+static void printconsistency(const pcpresentation &pc, const consistencycheck &c, const hollowpcvec &t) {
+  const gen i = c.i, j = c.j;
+
+  switch (c.type) {
+  case CJACOBI:
+#ifdef LIEALG
+    fprintf(LogFile, "# consistency: jacobi(a%d,a%d,a%d) = " PRIhollowpcvec "\n", i, j, c.k, &t);
+#elif defined(GROUP)
+    fprintf(LogFile, "# consistency: associator(a%d,a%d,a%d) = " PRIhollowpcvec "\n", c.k, j, i, &t);
+#elif defined(ASSOCALG)
+    fprintf(LogFile, "# consistency: associator(a%d,a%d,a%d) = " PRIhollowpcvec "\n", j, i, c.k, &t);
+#endif
+    break;
+  case CTORSION:
+    {
+      pccoeff annihilator;
+      annihilator.init();
+      unit_annihilator(nullptr, &annihilator, pc.Exponent[i]);
+#ifdef GROUP
+      fprintf(LogFile, "# consistency: (a%d^" PRIpccoeff ")^" PRIpccoeff " = " PRIhollowpcvec "\n", i, &pc.Exponent[i], &annihilator, &t);
+#else
+      fprintf(LogFile, "# consistency: " PRIpccoeff "*" PRIpccoeff "*a%d = " PRIhollowpcvec "\n", &annihilator, &pc.Exponent[i], i, &t);
+#endif
+      annihilator.clear();
+    }
+    break;
+  case CTORSIONCOMM:
+#ifdef LIEALG
+    if (pc.Jacobson)
+      fprintf(LogFile, "# consistency: [a%d,a%d,...,a%d]-[a%d,a%d^p] = " PRIhollowpcvec "\n", j, i, i, j, i, &t);
+    else
+      fprintf(LogFile, "# consistency: " PRIpccoeff "*[a%d,a%d]-[" PRIpccoeff "*a%d,a%d] = " PRIhollowpcvec "\n", &pc.Exponent[i], i, j, &pc.Exponent[i], i, j, &t);	   
+#elif defined(GROUP)
+    fprintf(LogFile, "# consistency: associator(a%d,a%d,a%d^(N-1)) = " PRIhollowpcvec "\n", j, i, i, &t);
+#elif defined(ASSOCALG)
+    fprintf(LogFile, "# consistency: " PRIpccoeff "*(a%d*a%d)-(" PRIpccoeff "*a%d)*a%d = " PRIhollowpcvec "\n", &pc.Exponent[i], i, j, &pc.Exponent[i], i, j, &t);
+    break;
+  case CTORSIONCOMMRIGHT:
+    fprintf(LogFile, "# consistency: " PRIpccoeff "*(a%d*a%d)-a%d*(" PRIpccoeff "*a%d) = " PRIhollowpcvec "\n", &pc.Exponent[i], j, i, j, &pc.Exponent[i], i, &t);
+#endif
+    break;
+  }
 }
 
 /* check consistency of pc presentation, and deduce relations to
  * impose on centre
  */
 void pcpresentation::consistency(matrix &m) const {
+  /* the checks are generated and run by chunks, so that they're not
+     all held in memory. Once the matrix has full rank, the remaining
+     checks can't change it, so they're skipped; full() is amortized
+     O(1), and is asked after each check.
+
+     over finite rings, the queue is flushed once at least as many
+     rows as there are central generators have been queued, and then
+     each time their number doubles. Over Z, eliminating in pieces
+     makes entries explode (a finite 3-generator group at class 8
+     went from 5s to over 5 minutes), so the checks are eliminated
+     all at once, after consistency(): the shortcut then only fires
+     after flushes that queuerow() makes by itself */
+  std::vector<consistencycheck> checks;
+  size_t queued = 0;
+#if MATCOEFF_P > 0
+  size_t nextflush = std::max<size_t>(NrTotalGens - NrPcGens, CONSISTENCY_BATCH);
+#else
+  size_t nextflush = -1;
+#endif
+
+  auto run = [this, &m, &checks, &queued, &nextflush]() {
+    parallel_ordered(checks.size(),
+      [this, &checks](unsigned n) { return consistencyvec(*this, checks[n]); },
+      [this, &checks, &m](unsigned n, const hollowpcvec &t) {
+	if (Debug >= 2)
+	  printconsistency(*this, checks[n], t);
+	m.queuerow(t);
+      });
+    queued += checks.size();
+    checks.clear();
+    if (queued >= nextflush) {
+      m.flushqueue();
+      nextflush *= 2;
+    }
+  };
+  // return false if the remaining checks may be skipped
+  auto add = [&run, &m, &checks, &queued, &nextflush](consistencycheck c) {
+    checks.push_back(c);
+    if (checks.size() >= CONSISTENCY_CHUNK || queued + checks.size() >= nextflush)
+      run();
+    return !m.full();
+  };
+
+  if (m.full())
+    goto done;
+
   // check Jacobi identity
   for (unsigned i = 1; i <= NrPcGens; i++) {
     if (Generator[i].type != DGEN)
@@ -556,138 +961,37 @@ void pcpresentation::consistency(matrix &m) const {
 	
 	if (Metabelian && commij + (Generator[k].cw > 1) >= 2)
 	  continue;
-	
-#ifdef LIEALG
-	hollowpcvec t = vecstack.fresh();
-	t.lie3bracket(*this, i, j, k, true);
-	t.lie3bracket(*this, j, k, i, true);
-	t.lie3bracket(*this, k, i, j, true);
-	t.collect(*this);
-
-	if (Debug >= 2)
-	  fprintf(LogFile, "# consistency: jacobi(a%d,a%d,a%d) = " PRIhollowpcvec "\n", i, j, k, &t);
-#elif defined(GROUP)
-	hollowpcvec t = tail_assoc(*this, k, j, i);
 
-	if (Debug >= 2)
-	  fprintf(LogFile, "# consistency: associator(a%d,a%d,a%d) = " PRIhollowpcvec "\n", k, j, i, &t);
-#elif defined(ASSOCALG)
-	hollowpcvec t = vecstack.fresh();
-	t.assocprod(*this, Prod[j][i], k, true);
-	t.assocprod(*this, j, Prod[i][k], false);
-	t.collect(*this);
-	if (Debug >= 2)
-	  fprintf(LogFile, "# consistency: associator(a%d,a%d,a%d) = " PRIhollowpcvec "\n", j, i, k, &t);
-#endif
-	m.queuerow(t);	
-	vecstack.release(t);
+	if (!add({CJACOBI, i, j, k}))
+	  goto done;
       }
     }
   }
   
-  pccoeff annihilator;
-  annihilator.init();
-
   // check torsion relations
   for (unsigned i = 1; i <= NrPcGens; i++)
     if (Jacobson || nz_p(Exponent[i])) {
-      /* if N*v = 0 in our ring, and we have a power relation A*g = w,
-       * enforce (N/A)*w = 0.
-       * if the group's exponent is given (by the torsion in the
-       * ccoefficients), impose a power relation.
-       */
-
-      if (!Jacobson) {
-	hollowpcvec t = vecstack.fresh();
-	
-	unit_annihilator(nullptr, &annihilator, Exponent[i]);
-#ifdef GROUP
-	hollowpcvec u = vecstack.fresh();
-	u.copy(Power[i]);      
-	t.pow(*this, u, annihilator);
-	vecstack.release(u);
-      
-	if (Debug >= 2)
-	  fprintf(LogFile, "# consistency: (a%d^" PRIpccoeff ")^" PRIpccoeff " = " PRIhollowpcvec "\n", i, &Exponent[i], &annihilator, &t);
-#else
-	t.addmul(annihilator, Power[i]);
-	t.collect(*this);
-  
-	if (Debug >= 2)
-	  fprintf(LogFile, "# consistency: " PRIpccoeff "*" PRIpccoeff "*a%d = " PRIhollowpcvec "\n", &annihilator, &Exponent[i], i, &t);
-#endif      
-	m.queuerow(t);
-	vecstack.release(t);
-      }
+      if (!Jacobson && !add({CTORSION, i, 0, 0}))
+	goto done;
       
       for (unsigned j = 1; j <= NrPcGens; j++) {
 	if (!isgoodweight_comm(i, j))
 	  continue;
-#ifdef LIEALG
-	/* two different meanings:
-	 * - in usual Lie algebras, enforce
-	     N*[a,b] = [N*a,b] if N is the order of a;
-	 * - in restricted Lie algebras, enforce [a,b,...,b] = [a,b^p] */
-	hollowpcvec t = vecstack.fresh();
-
-	// first, we compute -[N*ai,aj] or -[ai^p,aj]
-	for (const auto &kc : Power[i]) {
-	  gen g = kc.first;
-	  if (g > NrPcGens)
-	    break;
-	  if (g > j)
-	    t.submul(kc.second, Comm[g][j]);
-	  else if (g < j)
-	    t.addmul(kc.second, Comm[j][g]);
-	}
-
-	if (Jacobson)
-	  t.engel(*this, j, i, pccoeff::characteristic, false);
-	else {
-	  if (i > j)
-	    t.addmul(Exponent[i], Comm[i][j]);
-	  else if (i < j)
-	   t.submul(Exponent[i], Comm[j][i]);
-	}
-	t.collect(*this);
-	
-	if (Debug >= 2) {
-	  if (Jacobson)
-	    fprintf(LogFile, "# consistency: [a%d,a%d,...,a%d]-[a%d,a%d^p] = " PRIhollowpcvec "\n", j, i, i, j, i, &t);
-	  else
-	    fprintf(LogFile, "# consistency: " PRIpccoeff "*[a%d,a%d]-[" PRIpccoeff "*a%d,a%d] = " PRIhollowpcvec "\n", &Exponent[i], i, j, &Exponent[i], i, j, &t);	   
-	}
-#elif defined(GROUP)
-	/* enforce a^N*b = a^(N-1)*(a*b) or a*b^N = (a*b)*b^(N-1) in groups
-	 */
-	hollowpcvec t = tail_pow(*this, j, i);
-	
-	if (Debug >= 2)
-	 fprintf(LogFile, "# consistency: associator(a%d,a%d,a%d^(N-1)) = " PRIhollowpcvec "\n", j, i, i, &t);
-#elif defined(ASSOCALG)
-	/* enforce N*(a*b) = (N*a)*b and N*(b*a) = b*(N*a) if N is the order of a */
-	hollowpcvec t = vecstack.fresh();
-
-	t.assocprod(*this, Power[i], j, false);
-	t.addmul(Exponent[i], Prod[i][j]);
-	t.collect(*this);
-	if (Debug >= 2)
-	  fprintf(LogFile, "# consistency: " PRIpccoeff "*(a%d*a%d)-(" PRIpccoeff "*a%d)*a%d = " PRIhollowpcvec "\n", &Exponent[i], i, j, &Exponent[i], i, j, &t);
-	m.queuerow(t);
-
-	t.clear();
-	t.assocprod(*this, j, Power[i], false);
-	t.addmul(Exponent[i], Prod[j][i]);
-	t.collect(*this);
-	if (Debug >= 2)
-	  fprintf(LogFile, "# consistency: " PRIpccoeff "*(a%d*a%d)-a%d*(" PRIpccoeff "*a%d) = " PRIhollowpcvec "\n", &Exponent[i], j, i, j, &Exponent[i], i, &t);
-#endif	
-	m.queuerow(t);
-	vecstack.release(t);
+	if (!add({CTORSIONCOMM, i, j, 0}))
+	  goto done;
+#ifdef ASSOCALG
+	if (!add({CTORSIONCOMMRIGHT, i, j, 0}))
+	  goto done;
+#endif
       }
     }
-  
-  annihilator.clear();
+
+  if (!checks.empty())
+    run();
+
+ done:
+  if (Debug >= 2 && m.full())
+    fprintf(LogFile, "# consistency: matrix has full rank\n");
 
   TimeStamp("pcpresentation::consistency()");
 }
@@ -708,6 +1012,37 @@ void MapEndo(hollowpcvec &result, const pcpresentation &pc, sparsepcvec src, gen
   }
 }
 
+/* evaluate relator n, and call emit(w) on each relation w it
+ * yields: one for a relator, and one for each '=' in a relation
+ */
+template <typename E> static void evalrel(const pcpresentation &pc, node *n, E emit) {
+  node *t;
+  for (t = n; t->type == TREL; t = t->l);
+
+  hollowpcvec v = vecstack.fresh();
+  v.eval(pc, t);
+
+  for (t = n; t == n || t->type == TREL; t = t->l) {
+    hollowpcvec w;
+    if (t->type == TREL) {
+      w = vecstack.fresh();
+      w.eval(pc, t->r);
+      w.sub(v);
+    } else
+      w = v;
+      
+    w.collect(pc);
+
+    emit(w);
+      
+    if (t->type == TREL)
+      vecstack.release(w);
+    else
+      break;
+  }
+  vecstack.release(v);
+}
+
 // Evaluate all relations in pc, ship them to Matrix
 void pcpresentation::evalrels(matrix &m) {
   for (const auto &n : fp.Aliases) {
@@ -734,49 +1069,76 @@ void pcpresentation::evalrels(matrix &m) {
 
   std::deque<sparsepcvec> itrels;
 
-  for (const auto &n : fp.Relators) {
-    node *t;
-    for (t = n; t->type == TREL; t = t->l);
-
-    hollowpcvec v = vecstack.fresh();
-    v.eval(*this, t);
-
-    for (t = n; t == n || t->type == TREL; t = t->l) {
-      hollowpcvec w;
-      if (t->type == TREL) {
-	w = vecstack.fresh();
-	w.eval(*this, t->r);
-	w.sub(v);
-      } else
-	w = v;
-      
-      w.collect(*this);
-
-      if (Debug >= 2) {
-	fprintf(LogFile, "# relation: ");
-	fp.printnode(LogFile, n);
-	fprintf(LogFile, " (" PRIhollowpcvec ")\n", &w);
-      }
+  // add to the matrix a row w coming from relator n
+  auto addrel = [this, &m, &itrels](node *n, hollowpcvec &w) {
+    if (Debug >= 2) {
+      fprintf(LogFile, "# relation: ");
+      fp.printnode(LogFile, n);
+      fprintf(LogFile, " (" PRIhollowpcvec ")\n", &w);
+    }
 
 #ifdef ASSOCALG
-      if (!w.empty() && w.begin()->first == 0)
-	abortprintf(3, "Relation does not belong to augmentation ideal");
+    if (!w.empty() && w.begin()->first == 0)
+      abortprintf(3, "Relation does not belong to augmentation ideal");
 #endif
 
-      if (!fp.Endomorphisms.empty())
-	itrels.push_back(w.getsparse());
+    if (!fp.Endomorphisms.empty())
+      itrels.push_back(w.getsparse());
     
-      m.addrow(w);
-      
-      if (t->type == TREL)
-	vecstack.release(w);
-      else
+    m.addrow(w);
+  };
+
+  /* once the matrix has full rank, the remaining relators can't
+     change it */
+  size_t nrevaluated = 0;
+  if (NrThreads <= 1)
+    for (const auto &n : fp.Relators) {
+      if (m.full())
 	break;
+      evalrel(*this, n, [&addrel, n](hollowpcvec &w) { addrel(n, w); });
+      nrevaluated++;
     }
-    vecstack.release(v);
+  else {
+    /* relators are evaluated by worker threads, each with its own
+       vecstack, and their rows are added to the matrix here, in the
+       order of the relators; by batches, so as to stop early */
+    const size_t vecsize = vecstack.getsize(), batch = 64*NrThreads;
+
+    for (; nrevaluated < fp.Relators.size() && !m.full(); nrevaluated += batch) {
+      const size_t lo = nrevaluated;
+      ordered_pipeline<std::vector<sparsepcvec>>(NrThreads, std::min(batch, fp.Relators.size() - lo), batch,
+	[vecsize]() { vecstack.setsize(vecsize); },
+	[this, lo](size_t i) -> std::vector<sparsepcvec> {
+	  std::vector<sparsepcvec> rows;
+	  evalrel(*this, fp.Relators[lo+i], [&rows](hollowpcvec &w) { rows.push_back(w.getsparse()); });
+	  return rows;
+	},
+	[this, &addrel, lo](size_t i, std::vector<sparsepcvec> rows) {
+	  for (sparsepcvec &r : rows) {
+	    hollowpcvec w = vecstack.fresh();
+	    w.copy(r);
+	    r.free();
+	    addrel(fp.Relators[lo+i], w);
+	    vecstack.release(w);
+	  }
+	},
+	[](std::vector<sparsepcvec> rows) {
+	  for (sparsepcvec &r : rows)
+	    r.free();
+	});
+    }
+    nrevaluated = std::min(nrevaluated, fp.Relators.size());
   }
+  if (Debug >= 2 && nrevaluated < fp.Relators.size())
+    fprintf(LogFile, "# evalrels: matrix has full rank, skipping %zu relators\n", fp.Relators.size() - nrevaluated);
 
-  if (!fp.Endomorphisms.empty()) { // now t is a list of evaluations of rels
+  if (m.full()) { // no need to spin the relations
+    for (sparsepcvec t : itrels)
+      t.free();
+    itrels.clear();
+  }
+
+  if (!itrels.empty()) { // now t is a list of evaluations of rels
     std::vector<sparsepcmat> endos;
 
     for (const auto &n : fp.Endomorphisms) {
@@ -873,7 +1235,7 @@ void pcpresentation::evalrels(matrix &m) {
       }
     }
 
-    while (!itrels.empty()) {
+    while (!itrels.empty() && !m.full()) {
       sparsepcvec t = itrels.front();
       itrels.pop_front();
       
@@ -895,6 +1257,8 @@ void pcpresentation::evalrels(matrix &m) {
     }
 
     // free memory
+    for (sparsepcvec t : itrels)
+      t.free();
     for (const auto &phi : endos)
       for (auto r : phi)
 	r.free();
@@ -904,11 +1268,12 @@ void pcpresentation::evalrels(matrix &m) {
 }
 
 /* eliminate redundant generators from v; rels is a list of relations
-   in the centre, and renumber says how central generators are to be
-   renumbered.
+   in the centre, renumber says how central generators are to be
+   renumbered, and subst[k] is the normal form of eliminated generator
+   k, already renumbered.
 
    this routine is time-critical. */
-void pcpresentation::collecttail(sparsepcvec &v, const matrix &m, std::vector<int> renumber) {
+void pcpresentation::collecttail(sparsepcvec &v, const matrix &m, const std::vector<int> &renumber, const std::vector<sparsepcvec> &subst) {
   if (v.empty())
     return;
   
@@ -934,7 +1299,40 @@ void pcpresentation::collecttail(sparsepcvec &v, const matrix &m, std::vector<in
        replace v[readpos] has length <= readpos-writepos. That doesn't
        seem to be necessary.
     */
-  
+
+    /* the rest of v, times the substitution matrix. Since the matrix
+       is in Hermite normal form, this is already the normal form of
+       v, unless some torsion coefficient went out of range */
+    hollowpcvec hv = vecstack.fresh();
+    for (const auto &kc : v.window(readpos)) {
+      newg = renumber[kc.first];
+      if (newg >= 1)
+	hv[newg] += kc.second;
+      else if (newg < 0)
+	hv.addmul(kc.second, subst[kc.first]);
+    }
+
+    bool reduced = true;
+    for (const auto &kc : hv)
+      if (!reduced_p(kc.second, Exponent[kc.first])) {
+	reduced = false;
+	break;
+      }
+
+    if (reduced) {
+      v.resize(writepos+hv.size());
+      auto vi = v.window(writepos).begin();
+      for (const auto &kc : hv) {
+	vi->first = kc.first;
+	set(vi->second, kc.second);
+	++vi;
+      }
+      vi.markend();
+      vecstack.release(hv);
+      return;
+    }
+    vecstack.release(hv);
+
     sparsepcvec t = m.reducerow(v.window(readpos));
     // then, copy back at correct position and renumber. We're
     // guaranteed that renumber[kc.first] is always >= 1
@@ -962,6 +1360,7 @@ void pcpresentation::reduce(const matrix &m) {
      renumber[k] = 0 means it should be removed.
      renumber[k] = -1u means that it should be replaced by a relation. */
   std::vector<int> renumber(NrTotalGens + 1);
+  std::vector<sparsepcvec> subst(NrTotalGens + 1, sparsepcvec::null());
   unsigned trivialgens = 0;
 
   for (unsigned k = NrPcGens+1; k <= NrTotalGens; k++) {
@@ -980,15 +1379,26 @@ void pcpresentation::reduce(const matrix &m) {
       Power[newk] = r;
     else { // eliminate generator k
       trivialgens++;
-      if (r.empty())
+      if (r.empty()) {
 	renumber[k] = 0;
-      else
+	r.free();
+      } else {
 	renumber[k] = -1; // could be smarter, if Power[newk] is a single term
-      r.free();
+	subst[k] = r;
+      }
     }
   }
 
+  /* the substitution matrix, in the new numbering. The relations only
+     involve surviving generators, since the matrix is in Hermite
+     normal form */
+  for (sparsepcvec &r : subst)
+    if (r.allocated())
+      for (unsigned i = 0; r[i].first != sparsepcvec::eol; i++)
+	r[i].first = renumber[r[i].first];
+
   unsigned newnrpcgens = NrTotalGens - trivialgens;
+  Stats.eliminated += trivialgens;
 
   if (Debug >= 2) {
     fprintf(LogFile, "# renumbering:");
@@ -998,27 +1408,51 @@ void pcpresentation::reduce(const matrix &m) {
     fprintf(LogFile, "\n");
   }
     
+  /* each collecttail() only changes its own vector, so they may all
+     run concurrently. Only a few of them are expensive, namely those
+     that hit eliminated generators; so we spread the work with work
+     stealing. */
+  size_t vecsize = NrTotalGens;
+  auto collectall = [this, &m, &renumber, &subst, vecsize](const std::vector<sparsepcvec *> &vecs) {
+    if (NrThreads <= 1)
+      for (sparsepcvec *v : vecs)
+	collecttail(*v, m, renumber, subst);
+    else
+      parallel_for(NrThreads, vecs.size(), [vecsize]() { vecstack.setsize(vecsize); }, [this, &vecs, &m, &renumber, &subst](size_t i) {
+	  collecttail(*vecs[i], m, renumber, subst);
+	});
+  };
+  std::vector<sparsepcvec *> vecs;
+    
   /* Modify the torsions: (first, and in decreasing order, though it's unimportant) */
   for (unsigned j = NrTotalGens; j >= 1; j--)
     if (Power[j].allocated())
-      collecttail(Power[j], m, renumber);
+      vecs.push_back(&Power[j]);
   
   /*  Modify the epimorphisms: */
   for (unsigned j = 1; j <= fp.NrGens; j++)
-    collecttail(Epimorphism[j], m, renumber);
+    vecs.push_back(&Epimorphism[j]);
+
+  collectall(vecs);
   
   TimeStamp("pcpresentation::reduce1");
   /*  Modify the products: */
+  vecs.clear();
   for (unsigned j = 1; j <= NrPcGens; j++)
 #ifdef ASSOCALG
     for (unsigned l = 1; l <= NrPcGens; l++)
-      collecttail(Prod[j][l], m, renumber);
+      vecs.push_back(&Prod[j][l]);
 #else
     for (unsigned l = 1; l < j; l++)
-      collecttail(Comm[j][l], m, renumber);
+      vecs.push_back(&Comm[j][l]);
 #endif
+
+  collectall(vecs);
   TimeStamp("pcpresentation::reduce2");
 
+  for (sparsepcvec r : subst)
+    r.free();
+
   /* Let us alter the Generator as well. Recall that dead generators
    * cannot have definition at all. It is only the right of the living
    * ones.
@@ -1071,6 +1505,91 @@ void pcpresentation::reduce(const matrix &m) {
   TimeStamp("pcpresentation::reduce()");
 }
 
+/* compute the next class: add tails, make them consistent, impose the
+   relations and quotient by them. Return the number of new generators. */
+unsigned pcpresentation::nextclass() {
+  unsigned oldnrpcgens = NrPcGens;
+  Class++;
+
+  unsigned nrcentralgens = addtails(); // add fresh tails
+  StatsRecord(Class, "addtails");
+
+  {
+    matrix m(nrcentralgens, NrPcGens+1, TorsionFree);
+      
+    consistency(m); // enforce Jacobi and Z-linearity, via queue
+    StatsRecord(Class, "consistency");
+
+    m.flushqueue();
+    StatsRecord(Class, "flushqueue");
+      
+    evalrels(m);
+    StatsRecord(Class, "evalrels");
+
+    m.hermite();
+    StatsRecord(Class, "hermite");
+    
+    reduce(m); // quotient the cover by rels
+  }
+  StatsRecord(Class, "reduce");
+
+  return NrPcGens - oldnrpcgens;
+}
+
+/* undo a nextclass() interrupted by an exception: remove the new
+   generators, and the tails from all relations. Until nextclass()
+   completes, it only changes the entries beyond NrPcGens, so the
+   presentation of the previous class is still there. */
+void pcpresentation::abandonclass() {
+  auto truncate = [this](sparsepcvec &v) {
+    if (!v.allocated())
+      return;
+    unsigned len = 0, size = v.size();
+    while (len < size && v[len].first <= NrPcGens)
+      len++;
+    if (len < size) {
+      v.resize(size, len);
+      v.truncate(len);
+    }
+  };
+
+  for (unsigned i = 1; i <= NrPcGens; i++) {
+    truncate(Power[i]);
+    if (Power[i].allocated() && Power[i].empty() && z_p(Exponent[i])) { // tail of a new power relation
+      Power[i].free();
+      Power[i].noalloc();
+    }
+  }
+  for (unsigned i = 1; i <= fp.NrGens; i++)
+    truncate(Epimorphism[i]);
+#ifdef ASSOCALG
+  for (unsigned i = 1; i <= NrPcGens; i++)
+    for (unsigned j = 1; j <= NrPcGens; j++)
+      truncate(Prod[i][j]);
+  for (unsigned i = NrPcGens+1; i <= NrTotalGens; i++)
+    Prod[0][i].free(); // shared with Prod[i][0]
+  Prod[0].resize(NrPcGens+1);
+  Prod.resize(NrPcGens+1);
+#else
+  for (unsigned i = 1; i <= NrPcGens; i++)
+    for (unsigned j = 1; j < i; j++)
+      truncate(Comm[i][j]);
+#endif
+
+  for (unsigned i = NrPcGens+1; i <= NrTotalGens; i++) {
+    Exponent[i].clear();
+    Annihilator[i].clear();
+    if (Power[i].allocated())
+      Power[i].free();
+  }
+  Generator.resize(NrPcGens+1);
+  Exponent.resize(NrPcGens+1);
+  Annihilator.resize(NrPcGens+1);
+  Power.resize(NrPcGens+1);
+  NrTotalGens = NrPcGens;
+  Class--;
+}
+
 void pcpresentation::print(FILE *f, bool PrintCompact, bool PrintDefs, bool PrintZeros) const {
   fprintf(f, "<\n");
 
@@ -1453,7 +1972,7 @@ void pcpresentation::printGAP(FILE *f, int level) const {
   fprintf(f, "];\n");
 
   fprintf(f, "\tF!.series := [");
-  for (unsigned i = 0; i < Class; i++)
+  for (unsigned i = 0; i < LastGen.size(); i++)
     fprintf(f, "Subgroup(F,g{[%u..%u]}),", LastGen[i]+1, NrPcGens);
   fprintf(f, "];\n");
 
@@ -1542,3 +2061,106 @@ void pcpresentation::printGAP(FILE *f, int level) const {
 	  );
 }
 #endif
+
+/****************************************************************
+ * binary output, in the format described in anqread.h
+ */
+
+static int64_t binarycoeff(const pccoeff &c) {
+  integer<0,0> z;
+  z.init();
+  map(z, c);
+  if (z.cmp_si(INT64_MIN) < 0 || z.cmp_si(INT64_MAX) > 0)
+    abortprintf(1, "Coefficient " PRIpccoeff " is too large for binary output", &c);
+  int64_t n = z.get_si();
+  z.clear();
+  return n;
+}
+
+static void binaryput(FILE *f, const void *p, size_t len) {
+  if (fwrite(p, 1, len, f) != len)
+    abortprintf(1, "I can't write binary output: %s", strerror(errno));
+}
+
+void pcpresentation::printbinary(FILE *f) const {
+  std::vector<const sparsepcvec *> power, epimorphism, product;
+
+  for (unsigned i = 0; i <= NrPcGens; i++)
+    power.push_back(i > 0 && Power[i].allocated() ? &Power[i] : nullptr);
+  for (unsigned i = 0; i <= fp.NrGens; i++)
+    epimorphism.push_back(i > 0 ? &Epimorphism[i] : nullptr);
+  for (unsigned j = 1; j <= NrPcGens; j++)
+#ifdef ASSOCALG
+    for (unsigned i = 1; i <= NrPcGens; i++)
+      product.push_back(&Prod[j][i]);
+#else
+    for (unsigned i = 1; i < j; i++)
+      product.push_back(&Comm[j][i]);
+#endif
+
+  anq_header h;
+  memset(&h, 0, sizeof h);
+  memcpy(h.magic, ANQ_MAGIC, sizeof h.magic);
+  h.version = ANQ_VERSION;
+#ifdef LIEALG
+  h.algebra = ANQ_LIE;
+#elif defined(GROUP)
+  h.algebra = ANQ_GROUP;
+#else
+  h.algebra = ANQ_ASSOC;
+#endif
+  h.characteristic = PCCOEFF_P;
+  h.exponent = PCCOEFF_K;
+  h.nilclass = LastGen.size() - 1;
+  h.nrpcgens = NrPcGens;
+  h.nrfpgens = fp.NrGens;
+
+  for (const auto *rows : { &power, &epimorphism, &product })
+    for (const sparsepcvec *v : *rows)
+      if (v != nullptr && v->allocated())
+	h.nrterms += v->size();
+
+  h.generators = sizeof h;
+  h.power = h.generators + (NrPcGens + 1) * sizeof(anq_generator);
+  h.epimorphism = h.power + (power.size() + 1) * sizeof(uint64_t);
+  h.product = h.epimorphism + (epimorphism.size() + 1) * sizeof(uint64_t);
+  h.terms = h.product + (product.size() + 1) * sizeof(uint64_t);
+  h.size = h.terms + h.nrterms * sizeof(anq_term);
+  binaryput(f, &h, sizeof h);
+
+  for (unsigned i = 0; i <= NrPcGens; i++) {
+    anq_generator g;
+    memset(&g, 0, sizeof g);
+    if (i > 0) {
+      g.type = Generator[i].type;
+      g.w = Generator[i].w;
+      g.cw = Generator[i].cw;
+      g.g = Generator[i].a.g;
+      g.h = Generator[i].type == DCOMM ? Generator[i].a.h : 0;
+      g.exponent = binarycoeff(Exponent[i]);
+    }
+    binaryput(f, &g, sizeof g);
+  }
+
+  uint64_t ptr = 0;
+  for (const auto *rows : { &power, &epimorphism, &product }) {
+    binaryput(f, &ptr, sizeof ptr);
+    for (const sparsepcvec *v : *rows) {
+      if (v != nullptr && v->allocated())
+	ptr += v->size();
+      binaryput(f, &ptr, sizeof ptr);
+    }
+  }
+
+  for (const auto *rows : { &power, &epimorphism, &product })
+    for (const sparsepcvec *v : *rows)
+      if (v != nullptr && v->allocated())
+	for (const auto &kc : *v) {
+	  anq_term t = { kc.first, 0, binarycoeff(kc.second) };
+	  binaryput(f, &t, sizeof t);
+	}
+
+  TimeStamp("pcpresentation::printbinary()");
+}
+
+END_NQ
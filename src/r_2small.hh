@@ -101,6 +101,15 @@ public:
     data = (a.data * b) & COEFF_MASK;
   }
 
+  /* products that are summed before being reduced */
+  inline friend unsigned __int128 lazymul(const __local2_small &a, const __local2_small &b) {
+    return (unsigned __int128) a.data * b.data;
+  }
+
+  inline void reduce_lazy(unsigned __int128 T) {
+    data = (uint64_t) T & COEFF_MASK;
+  }
+
   inline void neg(const __local2_small &a) {
     data = (-a.data) & COEFF_MASK;
   }
@@ -32,6 +32,8 @@ public:
 
   inline int64_t get_si() const { return mpz_get_si(data); }
 
+  inline size_t sizeinbase(int base) const { return mpz_sizeinbase(data, base); }
+
   void zero() { mpz_set_si(data, 0); }
   
   inline void add(const __ring0 &a, const __ring0 &b) {
@@ -125,6 +127,15 @@ public:
     return mpz_get_str(s, base, data);
   }
 
+  // portable binary format, see mpz_out_raw
+  inline size_t out_raw(FILE *f) const {
+    return mpz_out_raw(f, data);
+  }
+
+  inline size_t inp_raw(FILE *f) {
+    return mpz_inp_raw(data, f);
+  }
+
   void swap(__ring0 &b) {
     mpz_swap(data, b.data);
   }
@@ -54,7 +54,7 @@ public:
     data = a.data + b;
 #else
     if (__builtin_expect(__builtin_saddll_overflow(a.data, b, (long long *) &data), false))
-      throw std::runtime_error("add(): coefficient overflow");
+      throw coeff_overflow("add(): coefficient overflow");
 #endif
   }
 
@@ -133,7 +133,7 @@ public:
     data = a.data * b;
 #else
     if (__builtin_expect(__builtin_smulll_overflow(a.data, b, (long long *) &data), false))
-      throw std::runtime_error("mul(): coefficient overflow");
+      throw coeff_overflow("mul(): coefficient overflow");
 #endif
   }
 
@@ -142,7 +142,7 @@ public:
     data = -a.data;
 #else
     if (__builtin_expect(__builtin_ssubll_overflow(0, a.data, (long long *) &data), false))
-      throw std::runtime_error("neg(): coefficient overflow");
+      throw coeff_overflow("neg(): coefficient overflow");
 #endif
   }
 
@@ -155,7 +155,7 @@ public:
     data = a.data - b.data;
 #else
     if (__builtin_expect(__builtin_ssubll_overflow(a.data, b.data, (long long *) &data), false))
-      throw std::runtime_error("sub(): coefficient overflow");
+      throw coeff_overflow("sub(): coefficient overflow");
 #endif
   }
 
@@ -255,6 +255,8 @@ public:
   }
 
   inline void map(const __ring0_mpz &a) {
+    if (!mpz_fits_slong_p(a.data))
+      throw coeff_overflow("map(): data cannot fit in an int64_t");
     set_si(a.get_si());
   }
 
@@ -266,13 +268,13 @@ public:
     data = a.data[0];
     for (unsigned i = 1; i < a.COEFF_WORDS; i++)
       if (a.data[i] != 0 || data < 0)
-	throw std::runtime_error("map(): data cannot fit in an int64_t");
+	throw coeff_overflow("map(): data cannot fit in an int64_t");
   }
 
   template<unsigned L> inline void map(const __local2_small<L> &a) {
     data = a.data;
     if (data < 0)
-      throw std::runtime_error("map(): cannot fit in an int64_t");
+      throw coeff_overflow("map(): cannot fit in an int64_t");
   }
 
   template<uint64_t P, unsigned L> inline void map(const __localp_big<P,L> &a) {
@@ -69,7 +69,7 @@ public:
 - -: -, carry=1
     */
     if (carry != period())
-      throw std::runtime_error("add() integer overflow");
+      throw coeff_overflow("add() integer overflow");
   }
 
   inline void add_si(const __ring0 &a, int64_t b) {
@@ -84,7 +84,7 @@ public:
     mp_limb_t carry = a.period();
     carry ^= (b >= 0) ? -mpn_add_1(data, a.data, K, b) : -mpn_sub_1(data, a.data, K, -b);
     if (carry != period())
-      throw std::runtime_error("add_si() integer overflow");
+      throw coeff_overflow("add_si() integer overflow");
   }
 
   inline void addmul(const __ring0 &a, const __ring0 &b) {
@@ -191,13 +191,13 @@ public:
     mpn_copyi(data, temp, K);
     for (unsigned i = K; i < 2*K; i++)
       if (temp[i] != period())
-	throw std::runtime_error("mul() integer overflow");
+	throw coeff_overflow("mul() integer overflow");
   }
 
   inline void mul_si(const __ring0 &a, int64_t b) {
     mp_limb_t carry = mpn_mul_1 (data, a.data, K, (b >= 0) ? b : -b);
     if (carry != period())
-      throw std::runtime_error("mul() integer overflow");
+      throw coeff_overflow("mul() integer overflow");
     if (b < 0)
       neg(*this);
   }
@@ -206,7 +206,7 @@ public:
     mp_limb_t carry = a.period();
     carry ^= -mpn_neg(data, a.data, K);
     if (carry != period())
-      throw std::runtime_error("neg() integer overflow");
+      throw coeff_overflow("neg() integer overflow");
   }
     
   inline int sgn() const {
@@ -229,7 +229,7 @@ public:
     mp_limb_t carry = a.period() ^ b.period();
     carry ^= -mpn_sub_n(data, a.data, b.data, K);
     if (carry != period())
-      throw std::runtime_error("sub() integer overflow");
+      throw coeff_overflow("sub() integer overflow");
   }
 
   inline void submul(const __ring0 &a, const __ring0 &b) {
@@ -324,7 +324,7 @@ public:
     } else {
       unsigned nzlimbs = __nzlimbs(a.data, L);
       if (K < nzlimbs)
-	throw std::runtime_error("map(): data doesn't fit in a fixed-int");
+	throw coeff_overflow("map(): data doesn't fit in a fixed-int");
 
       zero();
       mpn_copyi(data, a.data, nzlimbs);
@@ -337,7 +337,7 @@ public:
     if (sign) nzlimbs = -nzlimbs;
 
     if (K < nzlimbs || (K == nzlimbs && 0 > (uint64_t) a.data[0]._mp_d[nzlimbs-1]))
-      throw std::runtime_error("map(): data doesn't fit in a fixed-int");
+      throw coeff_overflow("map(): data doesn't fit in a fixed-int");
 
     zero();
     mpn_copyi(data, a.data[0]._mp_d, nzlimbs);
@@ -352,7 +352,7 @@ public:
   template<unsigned L> inline void map(const __local2_big<L> &a) {
     unsigned nzlimbs = __local2_big<L>::__nzlimbs(a.data, a.COEFF_WORDS);
     if (K < nzlimbs || (K == nzlimbs && 0 > (uint64_t) a.data[nzlimbs-1]))
-      throw std::runtime_error("map(): data doesn't fit in a fixed-int");
+      throw coeff_overflow("map(): data doesn't fit in a fixed-int");
 
     zero();
     mpn_copyi(data, a.data, nzlimbs);
@@ -366,7 +366,7 @@ public:
   template<uint64_t Q, unsigned L> inline void map(const __localp_big<Q,L> &a) {
     unsigned nzlimbs = __localp_big<Q,L>::__nzlimbs(a.data, a.COEFF_WORDS);
     if (K < nzlimbs || (K == nzlimbs && 0 > (uint64_t) a.data[nzlimbs-1]))
-      throw std::runtime_error("map(): data doesn't fit in a fixed-int");
+      throw coeff_overflow("map(): data doesn't fit in a fixed-int");
 
     zero();
     mpn_copyi(data, a.data, nzlimbs);
@@ -221,6 +221,16 @@ public:
     mul(a, int64_t2c(b));
   }
 
+  /* products that are summed before being reduced; the sum must not
+     overflow, e.g. less than 2^64 terms if N < 2^32 */
+  inline friend uint128_t lazymul(const __localp_small &a, const __localp_small &b) {
+    return (uint128_t) a.data * b.data;
+  }
+
+  inline void reduce_lazy(uint128_t T) {
+    data = montgomery_redc(T % MONTGOMERY_N);
+  }
+
   inline void neg(const __localp_small &a) {
     if (a.data == 0)
       data = 0;
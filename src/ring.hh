@@ -29,6 +29,12 @@ template<unsigned P> class __local2_big;
 template<uint64_t P, unsigned K> class __localp_small;
 template<uint64_t P, unsigned K> class __localp_big;
 
+/* thrown by integer<0,K>, K>0, when a result doesn't fit; the
+   computation may then be restarted with integer<0,0> */
+struct coeff_overflow : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
 typedef __ring0<0> __ring0_mpz;
 typedef __ring0<1> __ring0_64;
 #include "r_int0.hh"
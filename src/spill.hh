@@ -0,0 +1,67 @@
+/****************************************************************
+ * spill.hh
+ * the compact encoding of queued matrix rows, when they are spilled
+ * to disk (see matrix.cc): unsigned integers in LEB128, and integers
+ * of any size on top of it. Needs ring.hh.
+ ****************************************************************/
+
+#include <string>
+#include <vector>
+
+inline void putvarint(std::string &s, uint64_t n) {
+  while (n >= 0x80) {
+    s.push_back((char) (n | 0x80));
+    n >>= 7;
+  }
+  s.push_back((char) n);
+}
+
+inline uint64_t getvarint(const unsigned char *&p) {
+  uint64_t n = 0;
+  for (unsigned shift = 0;; shift += 7) {
+    n |= (uint64_t) (*p & 0x7f) << shift;
+    if (!(*p++ & 0x80))
+      return n;
+  }
+}
+
+/* z < 2^62 in absolute value is written as 2*zigzag(z); larger
+   integers as 1 + 2*sign + 4*length, and their base-2^32 digits */
+inline void putinteger(std::string &s, const integer<0,0> &z) {
+  if (z.sizeinbase(2) < 62) {
+    int64_t v = z.get_si();
+    putvarint(s, ((uint64_t) v << 1 ^ (uint64_t) (v >> 63)) << 1);
+    return;
+  }
+  integer<0,0> a;
+  a.init_set(z);
+  bool negative = a.sgn() < 0;
+  if (negative)
+    a.neg(a);
+  std::vector<uint64_t> digits;
+  while (a.nz_p())
+    digits.push_back(a.fdiv_q_ui(a, 1ULL << 32));
+  putvarint(s, 1 | negative << 1 | digits.size() << 2);
+  for (uint64_t d : digits)
+    putvarint(s, d);
+  a.clear();
+}
+
+inline void getinteger(const unsigned char *&p, integer<0,0> &z) {
+  uint64_t n = getvarint(p);
+  if (!(n & 1)) {
+    n >>= 1;
+    z.set_si((int64_t) (n >> 1) ^ -(int64_t) (n & 1));
+    return;
+  }
+  std::vector<uint64_t> digits(n >> 2);
+  for (uint64_t &d : digits)
+    d = getvarint(p);
+  z.zero();
+  for (auto d = digits.rbegin(); d != digits.rend(); d++) {
+    z.mul_si(z, 1LL << 32);
+    z.add_si(z, *d);
+  }
+  if (n & 2)
+    z.neg(z);
+}
@@ -0,0 +1,124 @@
+/****************************************************************
+ * test the binary output reader: a handmade file, and corrupt
+ * variants that anq_open should reject
+ ****************************************************************/
+
+#include "../anqread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+/* the Lie ring with generators a1, a2 and a3 = [a2,a1], over Z */
+struct testfile {
+  anq_header h;
+  anq_generator generators[4];
+  uint64_t power[5], epimorphism[4], product[4];
+  anq_term terms[3];
+};
+
+static void make(testfile &t) {
+  memset(&t, 0, sizeof t);
+  memcpy(t.h.magic, ANQ_MAGIC, sizeof t.h.magic);
+  t.h.version = ANQ_VERSION;
+  t.h.algebra = ANQ_LIE;
+  t.h.nilclass = 2;
+  t.h.nrpcgens = 3;
+  t.h.nrfpgens = 2;
+  t.h.generators = offsetof(testfile, generators);
+  t.h.power = offsetof(testfile, power);
+  t.h.epimorphism = offsetof(testfile, epimorphism);
+  t.h.product = offsetof(testfile, product);
+  t.h.terms = offsetof(testfile, terms);
+  t.h.nrterms = 3;
+  t.h.size = sizeof t;
+
+  t.generators[1] = { ANQ_DGEN, 1, 1, 1, 0, 0, 0 };
+  t.generators[2] = { ANQ_DGEN, 1, 1, 2, 0, 0, 0 };
+  t.generators[3] = { ANQ_DCOMM, 2, 2, 2, 1, 0, 0 };
+  // power: all rows empty; epimorphism: a1, a2; product: [a2,a1]=a3
+  t.epimorphism[2] = 1; t.epimorphism[3] = 2;
+  t.product[0] = 2; t.product[1] = 3; t.product[2] = 3; t.product[3] = 3;
+  t.terms[0] = { 1, 0, 1 };
+  t.terms[1] = { 2, 0, 1 };
+  t.terms[2] = { 3, 0, 1 };
+}
+
+static const char *path;
+
+static int open(const testfile &t, anq_file &f) {
+  FILE *file = fopen(path, "wb");
+  if (file == NULL || fwrite(&t, sizeof t, 1, file) != 1 || fclose(file) != 0) {
+    perror(path);
+    exit(1);
+  }
+  return anq_open(&f, path);
+}
+
+static unsigned failures;
+
+static void reject(const char *what, void (*corrupt)(testfile &)) {
+  testfile t;
+  make(t);
+  corrupt(t);
+  anq_file f;
+  errno = 0;
+  if (open(t, f) == 0) {
+    printf(" accepted %s", what);
+    anq_close(&f);
+    failures++;
+  } else if (errno != EINVAL) {
+    printf(" %s failed with errno %d", what, errno);
+    failures++;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  char name[] = "/tmp/anqread_testXXXXXX";
+  int fd = mkstemp(name);
+  if (fd < 0) {
+    perror(name);
+    return 1;
+  }
+  close(fd);
+  path = name;
+
+  printf("anqread:");
+  testfile t;
+  make(t);
+  anq_file f;
+  if (open(t, f) != 0) {
+    perror(" anq_open of a valid file");
+    failures++;
+  } else {
+    anq_vec v = anq_product(&f, 2, 1);
+    if (v.len != 1 || v.terms[0].gen != 3 || v.terms[0].coeff != 1) {
+      printf(" anq_product failed");
+      failures++;
+    }
+    v = anq_epimorphism(&f, 2);
+    if (v.len != 1 || v.terms[0].gen != 2) {
+      printf(" anq_epimorphism failed");
+      failures++;
+    }
+    if (anq_power(&f, 3).len != 0 || anq_product(&f, 3, 2).len != 0) {
+      printf(" empty rows failed");
+      failures++;
+    }
+    anq_close(&f);
+  }
+
+  reject("a bad magic", [](testfile &t) { t.h.magic[0] = 'X'; });
+  reject("a bad size", [](testfile &t) { t.h.size--; });
+  reject("a bad algebra", [](testfile &t) { t.h.algebra = 3; });
+  reject("a misaligned section", [](testfile &t) { t.h.terms += 4; });
+  reject("a section past the end", [](testfile &t) { t.h.nrterms = 4; });
+  reject("an overflowing offset", [](testfile &t) { t.h.product = UINT64_MAX & ~7ULL; });
+  reject("an overflowing count", [](testfile &t) { t.h.nrterms = UINT64_MAX / 2; });
+  reject("too many generators", [](testfile &t) { t.h.nrpcgens = UINT32_MAX; });
+  reject("decreasing pointers", [](testfile &t) { t.product[1] = 1; });
+  reject("a pointer past the terms", [](testfile &t) { t.product[3] = 4; });
+
+  unlink(path);
+  printf(failures ? "\n" : " ok\n");
+  return failures != 0;
+}
@@ -0,0 +1,62 @@
+/****************************************************************
+ * test the encoding of spilled matrix rows: integers written by
+ * putinteger should be read back by getinteger
+ ****************************************************************/
+
+#include "../ring.hh"
+#include "../spill.hh"
+#include <stdio.h>
+
+static unsigned failures;
+
+static void roundtrip(const integer<0,0> &z) {
+  std::string s;
+  putinteger(s, z);
+  putvarint(s, 12345); // a sentinel, to check where getinteger stops
+
+  const unsigned char *p = (const unsigned char *) s.data();
+  integer<0,0> w;
+  w.init();
+  getinteger(p, w);
+  if (w.cmp(z) != 0 || getvarint(p) != 12345 || p != (const unsigned char *) s.data() + s.size()) {
+    char buf[100];
+    printf(" %s failed", z.get_str(buf, sizeof buf, 10));
+    failures++;
+  }
+  w.clear();
+}
+
+int main() {
+  printf("spill:");
+  integer<0,0> z;
+  z.init();
+
+  for (int64_t v : std::initializer_list<int64_t>{ 0, 1, -1, 63, -64, 1LL << 60, -(1LL << 60), INT64_MAX, INT64_MIN }) {
+    z.set_si(v);
+    roundtrip(z);
+  }
+
+  // around the switch from the short to the long form, at 2^62
+  for (unsigned e : { 61, 62, 63, 64, 95, 96, 200 })
+    for (int d : { -1, 0, 1 })
+      for (int sign : { 1, -1 }) {
+	z.set_si(1);
+	for (unsigned i = 0; i < e; i++)
+	  z.mul_si(z, 2);
+	z.add_si(z, d);
+	if (sign < 0)
+	  z.neg(z);
+	roundtrip(z);
+      }
+
+  // 3^k, whose digits are all nonzero
+  z.set_si(1);
+  for (unsigned k = 0; k < 300; k++) {
+    roundtrip(z);
+    z.mul_si(z, 3);
+  }
+
+  z.clear();
+  printf(failures ? "\n" : " ok\n");
+  return failures != 0;
+}
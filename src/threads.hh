@@ -0,0 +1,269 @@
+/****************************************************************
+ * threads.hh
+ * simple primitives to spread independent computations over threads.
+ *
+ * - ordered_pipeline: worker threads produce results out of order,
+     and the calling thread consumes them in their original order.
+ * - task_graph: worker threads run tasks as soon as all the tasks
+     they depend on have completed.
+ * - parallel_for: worker threads run independent tasks of uneven
+     cost, with work stealing.
+ *
+ * in all cases, an exception thrown by a worker stops the computation
+ * and is rethrown in the calling thread.
+ ****************************************************************/
+
+#ifndef THREADS_HH
+#define THREADS_HH
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <stdexcept>
+
+/****************************************************************
+   ordered_pipeline<T>(nthreads, n, window, init, produce, consume, discard)
+
+   nthreads threads each call init(), and then repeatedly T produce(i)
+   for the next i in [0,n) that nobody claimed yet. The calling thread
+   calls consume(i, produce(i)) for i = 0, 1, ..., n-1 in that order.
+   At most window results are waiting to be consumed at any time, to
+   bound memory use. If the pipeline stops early, on an exception,
+   discard(r) is called on each result r that was produced but not
+   consumed, so that it may be freed.
+   ****************************************************************/
+template <typename T, typename I, typename P, typename C, typename D> void ordered_pipeline(unsigned nthreads, size_t n, size_t window, I init, P produce, C consume, D discard) {
+  std::mutex lock;
+  std::condition_variable changed;
+  std::vector<T> result(window);
+  std::vector<bool> ready(window, false);
+  size_t next = 0, consumed = 0;
+  bool stop = false;
+  std::exception_ptr error = nullptr;
+
+  auto worker = [&]() {
+    try {
+      init();
+      for (;;) {
+	size_t i;
+	{
+	  std::unique_lock<std::mutex> l(lock);
+	  changed.wait(l, [&]() { return stop || next >= n || next < consumed + window; });
+	  if (stop || next >= n)
+	    return;
+	  i = next++;
+	}
+	T r = produce(i);
+	{
+	  std::lock_guard<std::mutex> l(lock);
+	  result[i % window] = r;
+	  ready[i % window] = true;
+	}
+	changed.notify_all();
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> l(lock);
+      if (!error)
+	error = std::current_exception();
+      stop = true;
+      changed.notify_all();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < nthreads; t++)
+    threads.emplace_back(worker);
+
+  try {
+    for (size_t i = 0; i < n; i++) {
+      T r;
+      {
+	std::unique_lock<std::mutex> l(lock);
+	changed.wait(l, [&]() { return stop || ready[i % window]; });
+	if (stop)
+	  break;
+	r = result[i % window];
+	ready[i % window] = false;
+	consumed = i+1;
+      }
+      changed.notify_all();
+      consume(i, r);
+    }
+  } catch (...) {
+    std::lock_guard<std::mutex> l(lock);
+    if (!error)
+      error = std::current_exception();
+    stop = true;
+    changed.notify_all();
+  }
+
+  for (auto &t : threads)
+    t.join();
+
+  if (error) {
+    for (size_t j = 0; j < window; j++)
+      if (ready[j])
+	discard(result[j]);
+    std::rethrow_exception(error);
+  }
+}
+
+/****************************************************************
+   task_graph(nthreads, succ, npred, init, run)
+
+   run(t) is called once for each task t in [0,succ.size()), but only
+   after run(u) has returned for all u such that t belongs to succ[u];
+   there are npred[t] such u. nthreads threads each call init(), and
+   then run tasks as they become ready, in order of readiness.
+   ****************************************************************/
+template <typename I, typename R> void task_graph(unsigned nthreads, const std::vector<std::vector<size_t>> &succ, std::vector<size_t> npred, I init, R run) {
+  std::mutex lock;
+  std::condition_variable changed;
+  std::deque<size_t> ready;
+  const size_t n = succ.size();
+  size_t done = 0, running = 0;
+  bool stop = false;
+  std::exception_ptr error = nullptr;
+
+  for (size_t t = 0; t < n; t++)
+    if (npred[t] == 0)
+      ready.push_back(t);
+
+  auto worker = [&]() {
+    try {
+      init();
+      for (;;) {
+	size_t t;
+	{
+	  std::unique_lock<std::mutex> l(lock);
+	  changed.wait(l, [&]() { return stop || done == n || !ready.empty() || running == 0; });
+	  if (stop || done == n)
+	    return;
+	  if (ready.empty())
+	    throw std::logic_error("task_graph: dependencies are cyclic");
+	  t = ready.front();
+	  ready.pop_front();
+	  running++;
+	}
+	run(t);
+	{
+	  std::lock_guard<std::mutex> l(lock);
+	  running--;
+	  done++;
+	  for (size_t u : succ[t])
+	    if (--npred[u] == 0)
+	      ready.push_back(u);
+	}
+	changed.notify_all();
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> l(lock);
+      if (!error)
+	error = std::current_exception();
+      stop = true;
+      changed.notify_all();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < nthreads; t++)
+    threads.emplace_back(worker);
+
+  for (auto &t : threads)
+    t.join();
+
+  if (error)
+    std::rethrow_exception(error);
+}
+
+/****************************************************************
+   parallel_for(nthreads, n, init, body)
+
+   calls body(i) for all i in [0,n), in no particular order. nthreads
+   threads each call init(), and then start on their own contiguous
+   range of indices; a thread that runs out of work steals the back
+   half of the largest range left, so that a few expensive tasks
+   don't hold everybody else up.
+   ****************************************************************/
+template <typename I, typename B> void parallel_for(unsigned nthreads, size_t n, I init, B body) {
+  struct range {
+    std::mutex lock; // held to change begin or end
+    std::atomic<size_t> begin, end;
+  };
+  std::vector<range> ranges(nthreads);
+  std::mutex errorlock;
+  std::exception_ptr error = nullptr;
+  std::atomic<bool> stop(false);
+
+  for (unsigned t = 0; t < nthreads; t++) {
+    ranges[t].begin = n*t / nthreads;
+    ranges[t].end = n*(t+1) / nthreads;
+  }
+
+  auto worker = [&](unsigned self) {
+    try {
+      init();
+      while (!stop) {
+	size_t i;
+	bool claimed;
+	{
+	  std::lock_guard<std::mutex> l(ranges[self].lock);
+	  i = ranges[self].begin;
+	  claimed = (i < ranges[self].end);
+	  if (claimed)
+	    ranges[self].begin = i+1;
+	}
+	if (claimed) {
+	  body(i);
+	  continue;
+	}
+
+	// steal from the largest range; sizes are read without locking, as a hint
+	unsigned victim = self;
+	size_t largest = 0;
+	for (unsigned t = 0; t < nthreads; t++) {
+	  size_t begin = ranges[t].begin, end = ranges[t].end;
+	  if (end > begin + largest)
+	    largest = end - begin, victim = t;
+	}
+	if (largest == 0)
+	  return;
+
+	size_t begin, end;
+	{
+	  std::lock_guard<std::mutex> l(ranges[victim].lock);
+	  begin = (ranges[victim].begin + ranges[victim].end + 1) / 2;
+	  end = ranges[victim].end;
+	  if (begin < end)
+	    ranges[victim].end = begin;
+	}
+	if (begin < end) {
+	  std::lock_guard<std::mutex> l(ranges[self].lock);
+	  ranges[self].begin = begin;
+	  ranges[self].end = end;
+	}
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> l(errorlock);
+      if (!error)
+	error = std::current_exception();
+      stop = true;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < nthreads; t++)
+    threads.emplace_back(worker, t);
+
+  for (auto &t : threads)
+    t.join();
+
+  if (error)
+    std::rethrow_exception(error);
+}
+
+#endif
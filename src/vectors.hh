@@ -686,18 +686,22 @@ public:
 template <typename T> class vec_supply : public std::vector<T> {
   unsigned vecsize, pos;
 public:
-  vec_supply() : pos(0) { };
-  ~vec_supply() noexcept(false) {
-    if (pos != 0)
-      throw std::logic_error("cannot ~(): stack is not empty");
+  vec_supply() : vecsize(0), pos(0) { };
+  ~vec_supply() {
+    // pos may be non-0 if an exception (e.g. coefficient overflow)
+    // unwound the users of the vectors; they are still ours to free
     for (auto &p : *this)
       p.free(vecsize);
   }
   void setsize(size_t s) {
-    for (auto &p : *this)
-      p.resize(vecsize, s);
+    for (unsigned i = 0; i < this->size(); i++) {
+      if (i >= pos) // released vectors may still hold entries beyond s
+	(*this)[i].clear();
+      (*this)[i].resize(vecsize, s);
+    }
     vecsize = s;
   }
+  size_t getsize() const { return vecsize; }
   T &fresh() {
     if (pos == this->size()) {
       T v;
@@ -708,6 +712,7 @@ public:
     return (*this)[pos++];
   }
       
+  void reset() { pos = 0; } // forget fetched vectors, after an exception
   void release(const T &v) {
     if (pos-- == 0)
       throw std::logic_error("cannot pop(): stack is already empty");